@@ -1,22 +1,57 @@
+#include <ctype.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <string.h>
 #include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
 #include <iostream>
+#include <list>
+#include <mutex>
+#include <queue>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
-#define sizeOfAttribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
-
 enum NodeType
 {
 	NODE_INTERNAL,
 	NODE_LEAF
 };
 
+// Set in the node type byte of the nodes of index trees, whose keys are wider
+const uint8_t NODE_INDEX_FLAG = 0x80;
+
+/**
+ * Keys as the tree code handles them. Tables are keyed by their u32
+ * id, index trees by the value of the indexed column followed by the
+ * id of the row, which keeps every key unique. Only the first
+ * INDEX_KEY_VALUE_SIZE bytes of the value make it into the key, in
+ * an encoding that sorts like the values do, so rows whose values
+ * share them are told apart by the value kept in the record.
+ */
+typedef unsigned __int128 Key;
+const uint32_t TABLE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t INDEX_KEY_SIZE = sizeof(Key);
+const uint32_t INDEX_KEY_VALUE_SIZE = INDEX_KEY_SIZE - sizeof(uint32_t);
+
 /**
  * Common Node Header Layout 
  */
@@ -28,59 +63,374 @@ const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
 const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
 const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
 
+/**
+ * Internal Node Header Layout
+ */
+const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+
 /**
  * Leaf Node Header Layout
  */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_CONTENT_START_SIZE;
 
-const uint32_t COLUMN_USERNAME_SIZE = 32;
-const uint32_t COLUMN_EMAIL_SIZE = 255;
+enum ColumnType_t
+{
+	COLUMN_INTEGER,
+	COLUMN_REAL,
+	COLUMN_TEXT,
+	COLUMN_BLOB
+};
+
+struct Column
+{
+	string name;
+	ColumnType_t type;
+	uint32_t maxLength; // Longest TEXT or BLOB value in bytes
+};
+
+// Length of TEXT and BLOB columns declared without one, and the most any can have
+const uint32_t COLUMN_MAX_LENGTH = 1 << 20;
 
+/**
+ * The first column of every table is its INTEGER key, values holds
+ * the others in table order. INTEGER and REAL values are kept as
+ * their text, so they print and compare without the schema.
+ */
 struct Row
 {
 	uint32_t id;
-	char username[COLUMN_USERNAME_SIZE + 1];
-	char email[COLUMN_EMAIL_SIZE + 1];
+	vector<string> values;
 };
 
-const uint32_t ID_SIZE = sizeOfAttribute(Row, id);
-const uint32_t USERNAME_SIZE = sizeOfAttribute(Row, username);
-const uint32_t EMAIL_SIZE = sizeOfAttribute(Row, email);
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+/**
+ * Row Record Layout
+ * The id is the key of the cell, the record holds the remaining
+ * columns. INTEGER and REAL columns take COLUMN_NUMBER_SIZE bytes,
+ * TEXT and BLOB columns a length followed by that many bytes. A
+ * value longer than COLUMN_MAX_LOCAL_SIZE is moved to overflow pages
+ * and the record keeps COLUMN_OVERFLOW in place of the length,
+ * followed by the length of the value and its first overflow page.
+ */
+const uint32_t COLUMN_NUMBER_SIZE = sizeof(int64_t);
+const uint32_t COLUMN_LENGTH_SIZE = sizeof(uint16_t);
+const uint32_t COLUMN_MAX_LOCAL_SIZE = 255;
+const uint16_t COLUMN_OVERFLOW = UINT16_MAX;
+const uint32_t COLUMN_OVERFLOW_LENGTH_SIZE = sizeof(uint32_t);
+const uint32_t COLUMN_OVERFLOW_PAGE_SIZE = sizeof(uint32_t);
 
 const uint32_t PAGE_SIZE = 4096;
-const uint32_t TABLE_MAX_PAGES = 100;
-const uint32_t ROWS_PER_PAGE = PAGE_SIZE / ROW_SIZE;
-const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
+
+/**
+ * Overflow Page Layout
+ * Each page of a chain holds the next page number, 0 on the last
+ * page, followed by the next chunk of the value.
+ */
+const uint32_t OVERFLOW_NEXT_PAGE_SIZE = sizeof(uint32_t);
+const uint32_t OVERFLOW_NEXT_PAGE_OFFSET = 0;
+const uint32_t OVERFLOW_HEADER_SIZE = OVERFLOW_NEXT_PAGE_SIZE;
+const uint32_t OVERFLOW_SPACE_FOR_DATA = PAGE_SIZE - OVERFLOW_HEADER_SIZE;
+
+/**
+ * Buffer Pool
+ * Splits keep a few pages pinned on every level of the tree
+ * at once, so the pool can't be made arbitrarily small.
+ */
+const uint32_t DEFAULT_POOL_FRAMES = 1024;
+const uint32_t MIN_POOL_FRAMES = 32;
+
+/**
+ * Group Commit
+ * With no window, only statements that are already waiting on
+ * stdin join a commit group, so a lone statement is never delayed.
+ */
+const uint32_t DEFAULT_GROUP_COMMIT_MAX = 128;
+const uint32_t DEFAULT_GROUP_COMMIT_WINDOW_US = 0;
+
+/**
+ * Checkpointer
+ * The background checkpointer runs on a timer, and early once the
+ * log has grown past WAL_CHECKPOINT_FRAMES (about 4MB of pages).
+ */
+const uint32_t DEFAULT_CHECKPOINT_INTERVAL_MS = 1000;
+const uint32_t WAL_CHECKPOINT_FRAMES = 1000;
+
+/**
+ * Output
+ * Results go through one large stdout buffer that is flushed when
+ * it fills up or the REPL is about to wait for input, never per row.
+ */
+const uint32_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+/**
+ * Plan Cache
+ * Number of prepared statements kept for statements that come again
+ */
+const uint32_t PLAN_CACHE_SIZE = 64;
 
 /**
  * Leaf Node Body Layout
+ * Leaves are slotted pages. A slot array grows down from the header
+ * and holds the offset and size of each cell's record followed by
+ * its key. Records are packed up from the end of the page, the
+ * content start is the lowest record offset. Slots are kept in key
+ * order, records are in no particular order, so a search only
+ * touches the slots. The sizes here are those of table leaves,
+ * index leaves have INDEX_KEY_SIZE byte keys.
  */
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+const uint32_t LEAF_NODE_RECORD_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_RECORD_OFFSET_OFFSET = 0;
+const uint32_t LEAF_NODE_RECORD_SIZE_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_RECORD_SIZE_OFFSET = LEAF_NODE_RECORD_OFFSET_OFFSET + LEAF_NODE_RECORD_OFFSET_SIZE;
+const uint32_t LEAF_NODE_KEY_SIZE = TABLE_KEY_SIZE;
+const uint32_t LEAF_NODE_KEY_OFFSET = LEAF_NODE_RECORD_SIZE_OFFSET + LEAF_NODE_RECORD_SIZE_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_RECORD_OFFSET_SIZE + LEAF_NODE_RECORD_SIZE_SIZE + LEAF_NODE_KEY_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+// A leaf using less than this after a delete is merged with or borrows from a sibling
+const uint32_t LEAF_NODE_MIN_FILL = LEAF_NODE_SPACE_FOR_CELLS / 3;
+// A split leaves at least a third of a leaf on both sides only if no record is bigger
+const uint32_t ROW_MAX_SIZE = LEAF_NODE_MIN_FILL - LEAF_NODE_SLOT_SIZE;
+// Index leaves have wider keys, so their records are held to less
+const uint32_t INDEX_ROW_MAX_SIZE = LEAF_NODE_MIN_FILL - (LEAF_NODE_RECORD_OFFSET_SIZE + LEAF_NODE_RECORD_SIZE_SIZE + INDEX_KEY_SIZE);
+
+/**
+ * Internal Node Body Layout
+ * Sizes of table nodes, keys of index nodes are INDEX_KEY_SIZE bytes
+ */
+const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_SIZE = TABLE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_MAX_KEYS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
+
+// Right child of an internal node that has no children yet
+const uint32_t INVALID_PAGE_NUM = UINT32_MAX;
+
+/**
+ * Database Header Layout
+ * Page 0 of the database file holds the header. Freed pages go on
+ * the free list and are handed out again before the file grows.
+ */
+const uint32_t DB_MAGIC = 0x53514c33;
+
+struct DbHeader
+{
+	uint32_t magic;
+	uint32_t pageSize;
+	uint32_t freeListTrunk; // First trunk page of the free list, 0 if it is empty
+	uint32_t freePageCount;
+};
+
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+
+/**
+ * Schema
+ * The schema table, rooted at page 1, has a row for every other
+ * table and every index with its name, root page and the create
+ * statement that defines it. A new database starts with the users
+ * table, which statements that name no table use.
+ */
+const uint32_t SCHEMA_ROOT_PAGE_NUM = 1;
+const char *SCHEMA_TABLE_SQL = "create table schema (id integer, name text, root integer, sql text)";
+const char *DEFAULT_TABLE_SQL = "create table users (id integer, username text(32), email text)";
+const char *DEFAULT_TABLE_NAME = "users";
+
+/**
+ * Free List Trunk Page Layout
+ * The free list is a chain of trunk pages. Each trunk records the
+ * next trunk and the page numbers of up to FREE_LIST_TRUNK_MAX_LEAVES
+ * other free pages, its leaves.
+ */
+const uint32_t FREE_LIST_NEXT_TRUNK_SIZE = sizeof(uint32_t);
+const uint32_t FREE_LIST_NEXT_TRUNK_OFFSET = 0;
+const uint32_t FREE_LIST_NUM_LEAVES_SIZE = sizeof(uint32_t);
+const uint32_t FREE_LIST_NUM_LEAVES_OFFSET = FREE_LIST_NEXT_TRUNK_OFFSET + FREE_LIST_NEXT_TRUNK_SIZE;
+const uint32_t FREE_LIST_HEADER_SIZE = FREE_LIST_NEXT_TRUNK_SIZE + FREE_LIST_NUM_LEAVES_SIZE;
+const uint32_t FREE_LIST_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t FREE_LIST_TRUNK_MAX_LEAVES = (PAGE_SIZE - FREE_LIST_HEADER_SIZE) / FREE_LIST_LEAF_SIZE;
+
+/**
+ * Write-Ahead Log Layout
+ * The log lives next to the database in "<filename>-wal". It starts
+ * with a header and is followed by frames, each a frame header plus
+ * a full page image. A frame with a non-zero commitSize ends a
+ * transaction and records the number of pages in the database.
+ */
+const uint32_t WAL_MAGIC = 0x57414c31;
+
+struct WalHeader
+{
+	uint32_t magic;
+	uint32_t pageSize;
+	uint32_t checkpointSeq; // Bumped every time the log is reset
+	uint32_t reserved;
+	uint64_t checkpointLsn; // Frames up to here are in the database file
+};
+
+struct WalFrameHeader
+{
+	uint32_t pageNum;
+	uint32_t commitSize;
+	uint64_t lsn;
+	uint32_t checkpointSeq;
+	uint32_t checksum;
+};
+
+const uint32_t WAL_HEADER_SIZE = sizeof(WalHeader);
+const uint32_t WAL_FRAME_HEADER_SIZE = sizeof(WalFrameHeader);
+const uint32_t WAL_FRAME_SIZE = WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+
+/**
+ * Changed pages are appended to the log before they reach the
+ * database file. The index maps each page number to its latest
+ * frame so reads see logged pages that are not yet in the
+ * database file. Pages are copied back by a checkpoint.
+ *
+ * Only the main thread appends, the checkpointer thread resets the
+ * log. lock guards everything the two share: the header, index,
+ * end, commitEnd, the LSNs and the counters. The main thread may
+ * read lastLsn and commitLsn without it since nobody else writes them.
+ */
+struct Wal
+{
+	int file_descriptor;
+	string path;
+	bool created; // The log file did not exist before this session
+	WalHeader header;
+	uint64_t lastLsn;	 // Last frame appended
+	uint64_t commitLsn;	 // Last frame of the last committed transaction
+	uint64_t durableLsn; // Last frame known to be on disk
+	off_t end;			 // Where the next frame goes
+	off_t commitEnd;	 // Just past the last commit frame
+	unordered_map<uint32_t, off_t> index;
+	mutex lock;
+
+	uint64_t framesWritten;
+	uint64_t commits;
+	uint64_t syncs;
+	uint64_t checkpoints;
+};
+
+enum PagerMode
+{
+	PAGER_BUFFERED,
+	PAGER_MMAP
+};
+
+struct DbOptions
+{
+	uint32_t poolFrames;
+	PagerMode pagerMode;
+	uint32_t groupCommitMax;	  // Most commits that share one log sync
+	uint32_t groupCommitWindowUs; // How long a commit waits for others to join it
+	uint32_t checkpointIntervalMs; // 0 leaves checkpoints to db_close
+};
+
+/**
+ * Background thread that folds the log into the database file.
+ * It sleeps for intervalMs between checkpoints unless a commit
+ * asks for one early because the log has grown too big.
+ */
+struct Checkpointer
+{
+	thread worker;
+	mutex lock; // Guards stop and requested
+	condition_variable wakeup;
+	bool stop;
+	bool requested;
+	uint32_t intervalMs;
+};
+
+struct Frame
+{
+	void *data;
+	uint32_t page_num;
+	uint32_t pin_count;
+	bool dirty; // Modified since it was last written to the file
+	list<uint32_t>::iterator lru_position; // Only valid while unpinned
+};
 
+/**
+ * Pages are cached in a fixed number of frames. get_page pins the
+ * frame holding a page and every get_page must be matched by an
+ * unpin_page once the caller is done with the pointer. Unpinned
+ * frames are evicted in least recently used order. Callers that
+ * modify a page call mark_page_dirty. Dirty pages are appended to
+ * the write-ahead log, either at commit or when they are evicted,
+ * and reach the database file only through a checkpoint.
+ *
+ * In PAGER_MMAP mode the pages that exist when the file is opened
+ * are served straight out of a private mapping of the file. Writes
+ * to the mapping are copy-on-write and never reach the file by
+ * themselves, so dirty mapped pages are logged and checkpointed
+ * like any other page. Pages added after open go through the frames.
+ */
 struct Pager
 {
 	int file_descriptor;
 	uint32_t file_length;
 	uint32_t numPages;
-	void *pages[TABLE_MAX_PAGES];
+	uint32_t numFrames;
+	Frame *frames;
+	unordered_map<uint32_t, uint32_t> pageTable; // Page number to frame index
+	list<uint32_t> lru;							 // Unpinned frames, least recently used first
+	vector<uint32_t> freeFrames;
+
+	PagerMode mode;
+	char *map;
+	uint32_t mappedPages;
+	vector<bool> mappedDirty;
+
+	Wal *wal;
+	Checkpointer *checkpointer; // NULL when checkpoints only run at close
+
+	uint64_t pagesRead;
+	atomic<uint64_t> pagesWritten; // Written by the checkpointer thread
 };
 
 struct Table
 {
 	Pager *pager;
 	uint32_t root_page_num;
+	string name;
+	vector<Column> columns; // The first one is the INTEGER key
+	vector<struct Index *> indexes;
+};
+
+/**
+ * A secondary index on one column of a table. Its tree is keyed by
+ * index keys and its records hold the value of the indexed column
+ * and of any columns it includes, so the tree is opened as a table
+ * with the key and those columns. Statements that need no other
+ * columns are answered from the index alone.
+ */
+struct Index
+{
+	string name;
+	Table *table;
+	vector<uint32_t> columns; // Columns of table in the records, the indexed one first
+	Table *tree;
+};
+
+struct Database
+{
+	Pager *pager;
+	Table *schema;
+	vector<Table *> tables;	  // In the order they were created
+	vector<Index *> indexes; // Of all tables, in the order they were created
+	uint32_t schemaVersion;	  // Bumped by every table or index that is created
+	struct PlanCache *planCache;
+	vector<string> bindings; // Values set with .bind for the ? of later statements
+	bool inScript;		  // A -f or -c script runs as one transaction, committed at its end
 };
 
 struct Cursor
@@ -93,20 +443,181 @@ struct Cursor
 
 enum ExecuteResult
 {
-	EXECUTE_TABLE_FULL,
+	EXECUTE_DUPLICATE_KEY,
+	EXECUTE_UNBOUND_PARAMETER,
+	EXECUTE_TABLE_EXISTS,
+	EXECUTE_INDEX_EXISTS,
+	EXECUTE_ROW, // statementStep returned a row of a select
 	EXECUTE_SUCCESS
 };
 
 enum StatementType_t
 {
 	STATEMENT_INSERT,
-	STATEMENT_SELECT
+	STATEMENT_SELECT,
+	STATEMENT_DELETE,
+	STATEMENT_UPDATE,
+	STATEMENT_CREATE_TABLE,
+	STATEMENT_CREATE_INDEX
+};
+
+enum TokenType_t
+{
+	TOKEN_END,
+	TOKEN_WORD,	   // Keyword, name, number or unquoted value
+	TOKEN_STRING,  // Quoted string, the text is between the quotes with '' still doubled
+	TOKEN_SYMBOL,  // ( ) , ; = != <> < <= > >= * ?
+	TOKEN_INVALID  // Unterminated string
+};
+
+/**
+ * Tokens point into the statement text, so lexing never allocates
+ */
+struct Token
+{
+	TokenType_t type;
+	string_view text;
+};
+
+struct Lexer
+{
+	string_view input;
+	size_t position;
+};
+
+enum CompareOp_t
+{
+	COMPARE_EQ,
+	COMPARE_NE,
+	COMPARE_LT,
+	COMPARE_LE,
+	COMPARE_GT,
+	COMPARE_GE,
+	COMPARE_BETWEEN,
+	COMPARE_LIKE
+};
+
+struct AstCondition
+{
+	string_view column;
+	CompareOp_t op;
+	Token value;
+	Token high; // Upper bound of between
+};
+
+struct AstColumn
+{
+	string_view name;
+	Token type;
+	Token length; // TOKEN_END if the type has none
+};
+
+/**
+ * A statement as it was written. Names are not checked against the
+ * table yet and values are still tokens.
+ */
+struct AstStatement
+{
+	StatementType_t type;
+	string_view table;			 // Empty if the statement names none
+	string_view index;			 // Name of a create index, empty if it has none
+	vector<string_view> columns; // Select list or insert column list, empty for all, or the columns of a create index
+	vector<Token> values;		 // Insert rows one after the other
+	uint32_t valuesPerRow;
+	vector<pair<string_view, Token>> assignments;
+	vector<AstCondition> where; // All of them must hold
+	vector<AstColumn> definitions; // Columns of a create table
+};
+
+/**
+ * A condition the key range alone can't express, checked against
+ * every row in the range
+ */
+struct Filter
+{
+	uint32_t column;
+	CompareOp_t op;
+	uint32_t key; // Operand for the id column
+	uint32_t highKey;
+	string value; // Operand for the other columns
+	string high;
+};
+
+/**
+ * Where the value bound to a ? placeholder goes. The pointers are
+ * into the rows and filters of the statement, which get their final
+ * size before planning starts, so they never move.
+ */
+struct Parameter
+{
+	uint32_t column; // Decides how the value is checked and converted
+	bool pattern;	 // A like pattern, which is taken as it is
+	uint32_t *key;
+	string *text;
 };
 
 struct Statement
 {
 	StatementType_t type;
+	Table *table;
+	vector<Row> rows; // Rows an insert adds
+	// Columns an update assigns, their values are in row
 	Row row;
+	vector<bool> assigned; // By column
+	// Inclusive key range for select, delete and update, the whole table by default
+	uint32_t startKey;
+	uint32_t endKey;
+	vector<Filter> keyFilters; // Conditions on the id, they make up the key range
+	vector<Filter> filters;
+	// By column, those the filters check and those a select returns that no filter checks.
+	// A scan reads the second ones only for rows that pass the filters.
+	vector<bool> filterColumns;
+	vector<bool> returnColumns;
+	// Index that rows can be looked up in with filters[indexFilter], NULL if none
+	Index *index;
+	uint32_t indexFilter;
+	bool indexOnly; // The index holds every column the statement reads, so the table is never visited
+	// Range of index keys to look up, set when the statement runs. A like
+	// pattern that starts with a wildcard leaves useIndex false.
+	bool useIndex;
+	Key indexStart;
+	Key indexEnd;
+	vector<uint32_t> columns; // Columns a select returns, empty for all, or those of a create index, the indexed one first
+	vector<Parameter> parameters;
+	// Name and columns of the table a create table adds, or the name of a new index
+	string name;
+	vector<Column> definition;
+};
+
+/**
+ * A planned statement that can run many times with different values
+ * bound to its ? placeholders: statementPrepare once, then
+ * statementBind and statementStep until it is done, and
+ * statementReset before it runs again.
+ */
+struct PreparedStatement
+{
+	string sql;
+	Statement statement;
+	uint32_t schemaVersion; // Of the schema the statement was planned against
+	vector<bool> bound;
+	Cursor *cursor; // Where a select goes on at the next step
+	bool done;
+	list<PreparedStatement *>::iterator lruPosition; // Only used by the plan cache
+};
+
+/**
+ * Prepared statements of recent statements, keyed by their text
+ * without surrounding spaces and the final ;, and evicted in least
+ * recently used order
+ */
+struct PlanCache
+{
+	uint32_t capacity;
+	unordered_map<string, PreparedStatement *> plans;
+	list<PreparedStatement *> lru; // Most recently used first
+	uint64_t hits;
+	uint64_t misses;
 };
 
 enum PrepareResult_t
@@ -115,7 +626,11 @@ enum PrepareResult_t
 	PREPARE_UNRECOGNIZED_STATEMENT,
 	PREPARE_SYNTAX_ERROR,
 	PREPARE_STRING_TOO_LONG,
-	PREPARE_NEGATIVE_ID
+	PREPARE_NEGATIVE_ID,
+	PREPARE_UNKNOWN_TABLE,
+	PREPARE_READ_ONLY_TABLE,
+	PREPARE_ROW_TOO_LARGE,
+	PREPARE_ENTRY_TOO_LARGE
 };
 
 enum MetaCommandResult_t
@@ -124,477 +639,5948 @@ enum MetaCommandResult_t
 	META_COMMAND_UNRECOGNIZED_COMMAND
 };
 
-void *get_page(Pager *pager, uint32_t page_num)
+uint32_t wal_checksum(WalFrameHeader *frame_header, void *data)
 {
-	if (page_num > TABLE_MAX_PAGES)
+	// FNV-1a over the frame header (minus the checksum) and the page
+	uint32_t hash = 2166136261u;
+	unsigned char *bytes = (unsigned char *)frame_header;
+	for (uint32_t i = 0; i < offsetof(WalFrameHeader, checksum); i++)
 	{
-		cout << "Tried to fetch page number out of bounds. " << page_num << " > " << TABLE_MAX_PAGES << endl;
-		exit(EXIT_FAILURE);
+		hash = (hash ^ bytes[i]) * 16777619u;
 	}
-
-	if (pager->pages[page_num] == NULL)
+	bytes = (unsigned char *)data;
+	for (uint32_t i = 0; i < PAGE_SIZE; i++)
 	{
-		// Cache miss. Allocate memory and load from file
-		void *page = malloc(PAGE_SIZE);
-		uint32_t num_pages = pager->file_length / PAGE_SIZE;
-
-		// We might save a partial page at the end of the file
-		if (pager->file_length % PAGE_SIZE)
-		{
-			num_pages += 1;
-		}
-
-		if (page_num <= num_pages)
-		{
-			lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-			ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-			if (bytes_read == -1)
-			{
-				printf("Error reading file: %d\n", errno);
-				exit(EXIT_FAILURE);
-			}
-		}
-
-		pager->pages[page_num] = page;
-
-		if (page_num >= pager->numPages)
-		{
-			pager->numPages += 1;
-		}
+		hash = (hash ^ bytes[i]) * 16777619u;
 	}
-
-	return pager->pages[page_num];
+	return hash;
 }
 
-uint32_t *leaf_node_num_cells(void *node)
+void wal_write_header(Wal *wal)
 {
-	return (uint32_t *)node + LEAF_NODE_NUM_CELLS_OFFSET;
+	ssize_t bytes_written = pwrite(wal->file_descriptor, &(wal->header), WAL_HEADER_SIZE, 0);
+	if (bytes_written != WAL_HEADER_SIZE)
+	{
+		printf("Error writing wal header: %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
 }
 
-void *leaf_node_cell(void *node, uint32_t cell_num)
+void wal_fdatasync(Wal *wal)
 {
-	return (char *)node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+	if (fdatasync(wal->file_descriptor) == -1)
+	{
+		printf("Error syncing wal: %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
 }
 
-uint32_t *leaf_node_key(void *node, uint32_t cell_num)
+/**
+ * Sync every frame appended so far. Only called from the main
+ * thread, the log lock is not held across the sync itself.
+ */
+void wal_sync(Wal *wal)
 {
-	return (uint32_t *)leaf_node_cell(node, cell_num);
+	uint64_t lsn = wal->lastLsn;
+	wal_fdatasync(wal);
+
+	lock_guard<mutex> guard(wal->lock);
+	if (lsn > wal->durableLsn)
+	{
+		wal->durableLsn = lsn;
+	}
+	wal->syncs += 1;
 }
 
-void *leaf_node_value(void *node, uint32_t cell_num)
+/**
+ * Make sure the log is on disk up to lsn. A single sync covers
+ * every commit appended before it.
+ */
+void wal_sync_to(Wal *wal, uint64_t lsn)
 {
-	return (char *)leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
-}
+	bool durable;
+	{
+		lock_guard<mutex> guard(wal->lock);
+		durable = wal->durableLsn >= lsn;
+	}
 
-void initialize_leaf_node(void *node) { *leaf_node_num_cells(node) = 0; }
+	if (!durable)
+	{
+		wal_sync(wal);
+	}
+}
 
-Cursor *tableStart(Table *table)
+/**
+ * Scan the log and rebuild the index from every transaction that
+ * was committed. The scan stops at the first frame that is torn,
+ * has a bad checksum or belongs to an older generation of the log,
+ * and anything after the last commit frame is discarded.
+ * Returns the number of pages in the database as of the last
+ * commit, or 0 if nothing was committed.
+ */
+uint32_t wal_recover(Wal *wal)
 {
-	Cursor *cursor = new Cursor();
-	cursor->table = table;
-	cursor->page_num = table->root_page_num;
-	cursor->cell_num = 0;
+	uint32_t committed_num_pages = 0;
+	unordered_map<uint32_t, off_t> pending;
+	char *frame = (char *)malloc(WAL_FRAME_SIZE);
+	off_t offset = WAL_HEADER_SIZE;
+	uint64_t expected_lsn = wal->header.checkpointLsn + 1;
 
-	void *root_node = get_page(table->pager, table->root_page_num);
-	uint32_t num_cells = *leaf_node_num_cells(root_node);
-	cursor->endOfTable = (num_cells == 0);
+	while (pread(wal->file_descriptor, frame, WAL_FRAME_SIZE, offset) == WAL_FRAME_SIZE)
+	{
+		WalFrameHeader *frame_header = (WalFrameHeader *)frame;
+		if (frame_header->lsn != expected_lsn ||
+			frame_header->checkpointSeq != wal->header.checkpointSeq ||
+			frame_header->checksum != wal_checksum(frame_header, frame + WAL_FRAME_HEADER_SIZE))
+		{
+			break;
+		}
 
-	return cursor;
-}
+		pending[frame_header->pageNum] = offset;
+		offset += WAL_FRAME_SIZE;
+		expected_lsn += 1;
 
-Cursor *tableEnd(Table *table)
-{
-	Cursor *cursor = new Cursor();
-	cursor->table = table;
-	cursor->page_num = table->root_page_num;
-	cursor->endOfTable = true;
+		if (frame_header->commitSize != 0)
+		{
+			for (unordered_map<uint32_t, off_t>::iterator entry = pending.begin(); entry != pending.end(); entry++)
+			{
+				wal->index[entry->first] = entry->second;
+			}
+			pending.clear();
+			committed_num_pages = frame_header->commitSize;
+			wal->commitLsn = frame_header->lsn;
+			wal->end = offset;
+			wal->commitEnd = offset;
+		}
+	}
 
-	void *root_node = get_page(table->pager, table->root_page_num);
-	uint32_t num_cells = *leaf_node_num_cells(root_node);
-	cursor->cell_num = num_cells;
-	cursor->endOfTable = true;
+	free(frame);
+	wal->lastLsn = wal->commitLsn;
+	wal->durableLsn = wal->commitLsn;
 
-	return cursor;
+	return committed_num_pages;
 }
 
-void pager_flush(Pager *pager, uint32_t page_num)
+Wal *wal_open(const char *db_filename)
 {
-	if (pager->pages[page_num] == NULL)
+	Wal *wal = new Wal();
+	wal->path = string(db_filename) + "-wal";
+	wal->created = access(wal->path.c_str(), F_OK) != 0;
+	wal->file_descriptor = open(wal->path.c_str(), O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+
+	if (wal->file_descriptor == -1)
 	{
-		cout << "Tried to flush null page" << endl;
+		cout << "Unable to open wal file" << endl;
 		exit(EXIT_FAILURE);
 	}
 
-	off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+	wal->framesWritten = 0;
+	wal->commits = 0;
+	wal->syncs = 0;
+	wal->checkpoints = 0;
 
-	if (offset == -1)
+	ssize_t bytes_read = pread(wal->file_descriptor, &(wal->header), WAL_HEADER_SIZE, 0);
+	if (bytes_read != WAL_HEADER_SIZE || wal->header.magic != WAL_MAGIC || wal->header.pageSize != PAGE_SIZE)
 	{
-		printf("Error seeking: %d\n", errno);
-		exit(EXIT_FAILURE);
+		// New or unusable log, start a fresh one
+		wal->header.magic = WAL_MAGIC;
+		wal->header.pageSize = PAGE_SIZE;
+		wal->header.checkpointSeq = 0;
+		wal->header.reserved = 0;
+		wal->header.checkpointLsn = 0;
+		wal_write_header(wal);
 	}
 
-	ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+	wal->lastLsn = wal->header.checkpointLsn;
+	wal->commitLsn = wal->header.checkpointLsn;
+	wal->durableLsn = wal->header.checkpointLsn;
+	wal->end = WAL_HEADER_SIZE;
+	wal->commitEnd = WAL_HEADER_SIZE;
 
-	if (bytes_written == -1)
-	{
-		printf("Error writing: %d\n", errno);
-		exit(EXIT_FAILURE);
-	}
+	return wal;
 }
 
-void db_close(Table *table)
+/**
+ * Append a page image to the log. commit_size is the number of
+ * pages in the database if this frame commits a transaction, 0
+ * otherwise. The frame is not durable until wal_sync.
+ */
+void wal_append(Wal *wal, uint32_t page_num, void *data, uint32_t commit_size)
 {
-	Pager *pager = table->pager;
+	char frame[WAL_FRAME_SIZE];
+	WalFrameHeader *frame_header = (WalFrameHeader *)frame;
 
-	for (uint32_t i = 0; i < pager->numPages; i++)
-	{
-		if (pager->pages[i] == NULL)
-		{
-			continue;
-		}
-		pager_flush(pager, i);
-		free(pager->pages[i]);
-		pager->pages[i] = NULL;
-	}
+	frame_header->pageNum = page_num;
+	frame_header->commitSize = commit_size;
+	frame_header->lsn = wal->lastLsn + 1;
+	memcpy(frame + WAL_FRAME_HEADER_SIZE, data, PAGE_SIZE);
 
-	int result = close(pager->file_descriptor);
-	if (result == -1)
+	// checkpointSeq changes when the checkpointer resets the log
+	lock_guard<mutex> guard(wal->lock);
+	frame_header->checkpointSeq = wal->header.checkpointSeq;
+	frame_header->checksum = wal_checksum(frame_header, frame + WAL_FRAME_HEADER_SIZE);
+
+	ssize_t bytes_written = pwrite(wal->file_descriptor, frame, WAL_FRAME_SIZE, wal->end);
+	if (bytes_written != WAL_FRAME_SIZE)
 	{
-		cout << "Error closing db file." << endl;
+		printf("Error writing wal: %d\n", errno);
 		exit(EXIT_FAILURE);
 	}
 
-	for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+	wal->index[page_num] = wal->end;
+	wal->end += WAL_FRAME_SIZE;
+	wal->lastLsn += 1;
+	wal->framesWritten += 1;
+
+	if (commit_size != 0)
 	{
-		void *page = pager->pages[i];
-		if (page)
-		{
-			free(page);
-			pager->pages[i] = NULL;
-		}
+		wal->commitLsn = wal->lastLsn;
+		wal->commitEnd = wal->end;
+		wal->commits += 1;
 	}
-
-	free(pager);
 }
 
-Pager *pager_open(const char *filename)
+void wal_read_page(Wal *wal, off_t frame_offset, void *destination)
 {
-	int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
-
-	if (fd == -1)
+	ssize_t bytes_read = pread(wal->file_descriptor, destination, PAGE_SIZE, frame_offset + WAL_FRAME_HEADER_SIZE);
+	if (bytes_read != PAGE_SIZE)
 	{
-		cout << "Unable to open file" << endl;
+		printf("Error reading wal: %d\n", errno);
 		exit(EXIT_FAILURE);
 	}
+}
 
-	off_t file_length = lseek(fd, 0, SEEK_END);
-	Pager *pager = new Pager();
-	pager->file_descriptor = fd;
-	pager->file_length = file_length;
-	pager->numPages = (file_length / PAGE_SIZE);
+/**
+ * Read the latest logged image of a page. Returns false if the page
+ * is not in the log. The lookup and the read happen under the lock
+ * so a reset cannot recycle the frame in between.
+ */
+bool wal_read_latest(Wal *wal, uint32_t page_num, void *destination)
+{
+	lock_guard<mutex> guard(wal->lock);
 
-	if (file_length % PAGE_SIZE != 0)
+	unordered_map<uint32_t, off_t>::iterator logged = wal->index.find(page_num);
+	if (logged == wal->index.end())
 	{
-		printf("Db file is not a whole number of pages. Corrupt file.\n");
-		exit(EXIT_FAILURE);
+		return false;
 	}
 
-	for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+	wal_read_page(wal, logged->second, destination);
+	return true;
+}
+
+uint64_t wal_num_frames(Wal *wal)
+{
+	lock_guard<mutex> guard(wal->lock);
+	return (wal->end - WAL_HEADER_SIZE) / WAL_FRAME_SIZE;
+}
+
+/**
+ * Start the log over once every frame in it has been checkpointed.
+ * Bumping checkpointSeq keeps stale frames from being replayed if
+ * the truncate does not survive a crash. The caller holds the lock.
+ */
+void wal_reset(Wal *wal)
+{
+	wal->header.checkpointSeq += 1;
+	wal->header.checkpointLsn = wal->lastLsn;
+	wal_write_header(wal);
+
+	if (ftruncate(wal->file_descriptor, WAL_HEADER_SIZE) == -1)
 	{
-		pager->pages[i] = NULL;
+		printf("Error truncating wal: %d\n", errno);
+		exit(EXIT_FAILURE);
 	}
+	wal_fdatasync(wal);
 
-	return pager;
+	wal->durableLsn = wal->lastLsn;
+	wal->end = WAL_HEADER_SIZE;
+	wal->commitEnd = WAL_HEADER_SIZE;
+	wal->index.clear();
 }
 
-Table *db_open(const char *filename)
+void pager_write_page(Pager *pager, uint32_t page_num, void *data)
 {
-	Pager *pager = pager_open(filename);
-	uint32_t numRows = pager->file_length / ROW_SIZE;
+	ssize_t bytes_written = pwrite(pager->file_descriptor, data, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
 
-	Table *table = new Table();
+	if (bytes_written != PAGE_SIZE)
+	{
+		printf("Error writing: %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+
+	pager->pagesWritten += 1;
+}
+
+/**
+ * Cached copy of a page, or NULL if the page is not in memory
+ */
+void *pager_cached_page(Pager *pager, uint32_t page_num, bool *dirty)
+{
+	if (page_num < pager->mappedPages)
+	{
+		*dirty = pager->mappedDirty[page_num];
+		return pager->map + (size_t)page_num * PAGE_SIZE;
+	}
+
+	unordered_map<uint32_t, uint32_t>::iterator entry = pager->pageTable.find(page_num);
+	if (entry == pager->pageTable.end())
+	{
+		return NULL;
+	}
+
+	*dirty = pager->frames[entry->second].dirty;
+	return pager->frames[entry->second].data;
+}
+
+/**
+ * Find a frame to load a page into. Unused frames are handed out
+ * first, after that the least recently used unpinned page is
+ * evicted. A dirty victim is appended to the log without a commit
+ * mark, reads of it are then served from the log.
+ */
+uint32_t pager_take_frame(Pager *pager)
+{
+	if (!pager->freeFrames.empty())
+	{
+		uint32_t frame_index = pager->freeFrames.back();
+		pager->freeFrames.pop_back();
+		return frame_index;
+	}
+
+	if (pager->lru.empty())
+	{
+		printf("Buffer pool exhausted, all %d frames are pinned.\n", pager->numFrames);
+		exit(EXIT_FAILURE);
+	}
+
+	uint32_t frame_index = pager->lru.front();
+	pager->lru.pop_front();
+
+	Frame *victim = &(pager->frames[frame_index]);
+	if (victim->dirty)
+	{
+		wal_append(pager->wal, victim->page_num, victim->data, 0);
+		victim->dirty = false;
+	}
+	pager->pageTable.erase(victim->page_num);
+
+	return frame_index;
+}
+
+void *get_page(Pager *pager, uint32_t page_num)
+{
+	if (page_num < pager->mappedPages)
+	{
+		return pager->map + (size_t)page_num * PAGE_SIZE;
+	}
+
+	Frame *frame;
+	unordered_map<uint32_t, uint32_t>::iterator entry = pager->pageTable.find(page_num);
+
+	if (entry != pager->pageTable.end())
+	{
+		frame = &(pager->frames[entry->second]);
+		if (frame->pin_count == 0)
+		{
+			pager->lru.erase(frame->lru_position);
+		}
+	}
+	else
+	{
+		// Cache miss. Take a frame and load the page from file
+		uint32_t frame_index = pager_take_frame(pager);
+		frame = &(pager->frames[frame_index]);
+		frame->page_num = page_num;
+		frame->pin_count = 0;
+		frame->dirty = false;
+
+		// Every page below numPages was logged or written out before it was evicted
+		if (wal_read_latest(pager->wal, page_num, frame->data))
+		{
+			pager->pagesRead += 1;
+		}
+		else if (page_num < pager->numPages)
+		{
+			ssize_t bytes_read = pread(pager->file_descriptor, frame->data, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+			if (bytes_read == -1)
+			{
+				printf("Error reading file: %d\n", errno);
+				exit(EXIT_FAILURE);
+			}
+			pager->pagesRead += 1;
+		}
+		else
+		{
+			// New page, it has to be logged even if nobody writes to it
+			memset(frame->data, 0, PAGE_SIZE);
+			frame->dirty = true;
+			pager->numPages = page_num + 1;
+		}
+
+		pager->pageTable[page_num] = frame_index;
+	}
+
+	frame->pin_count += 1;
+	return frame->data;
+}
+
+void mark_page_dirty(Pager *pager, uint32_t page_num)
+{
+	if (page_num < pager->mappedPages)
+	{
+		pager->mappedDirty[page_num] = true;
+		return;
+	}
+
+	unordered_map<uint32_t, uint32_t>::iterator entry = pager->pageTable.find(page_num);
+	if (entry == pager->pageTable.end() || pager->frames[entry->second].pin_count == 0)
+	{
+		cout << "Tried to dirty page " << page_num << " that is not pinned" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	pager->frames[entry->second].dirty = true;
+}
+
+void unpin_page(Pager *pager, uint32_t page_num)
+{
+	if (page_num < pager->mappedPages)
+	{
+		// Mapped pages are never evicted
+		return;
+	}
+
+	unordered_map<uint32_t, uint32_t>::iterator entry = pager->pageTable.find(page_num);
+	if (entry == pager->pageTable.end() || pager->frames[entry->second].pin_count == 0)
+	{
+		cout << "Tried to unpin page " << page_num << " that is not pinned" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	Frame *frame = &(pager->frames[entry->second]);
+	frame->pin_count -= 1;
+
+	if (frame->pin_count == 0)
+	{
+		frame->lru_position = pager->lru.insert(pager->lru.end(), entry->second);
+	}
+}
+
+NodeType get_node_type(void *node)
+{
+	uint8_t value = *((uint8_t *)((char *)node + NODE_TYPE_OFFSET));
+	return (NodeType)(value & ~NODE_INDEX_FLAG);
+}
+
+void set_node_type(void *node, NodeType type)
+{
+	uint8_t value = type;
+	*((uint8_t *)((char *)node + NODE_TYPE_OFFSET)) = value;
+}
+
+bool is_node_root(void *node)
+{
+	uint8_t value = *((uint8_t *)((char *)node + IS_ROOT_OFFSET));
+	return (bool)value;
+}
+
+void set_node_root(void *node, bool is_root)
+{
+	uint8_t value = is_root;
+	*((uint8_t *)((char *)node + IS_ROOT_OFFSET)) = value;
+}
+
+bool is_index_node(void *node)
+{
+	uint8_t value = *((uint8_t *)((char *)node + NODE_TYPE_OFFSET));
+	return (value & NODE_INDEX_FLAG) != 0;
+}
+
+void set_node_index(void *node, bool is_index)
+{
+	uint8_t *value = (uint8_t *)((char *)node + NODE_TYPE_OFFSET);
+	*value = is_index ? *value | NODE_INDEX_FLAG : *value & ~NODE_INDEX_FLAG;
+}
+
+uint32_t node_key_size(void *node)
+{
+	return is_index_node(node) ? INDEX_KEY_SIZE : TABLE_KEY_SIZE;
+}
+
+/**
+ * Keys are stored in as many bytes as the tree they belong to uses
+ */
+Key read_key(void *node, const void *source)
+{
+	if (is_index_node(node))
+	{
+		Key key;
+		memcpy(&key, source, INDEX_KEY_SIZE);
+		return key;
+	}
+
+	uint32_t key;
+	memcpy(&key, source, TABLE_KEY_SIZE);
+	return key;
+}
+
+void write_key(void *node, void *destination, Key key)
+{
+	if (is_index_node(node))
+	{
+		memcpy(destination, &key, INDEX_KEY_SIZE);
+		return;
+	}
+
+	uint32_t table_key = (uint32_t)key;
+	memcpy(destination, &table_key, TABLE_KEY_SIZE);
+}
+
+uint32_t *node_parent(void *node)
+{
+	return (uint32_t *)((char *)node + PARENT_POINTER_OFFSET);
+}
+
+void update_node_parent(Pager *pager, uint32_t page_num, uint32_t parent_page_num)
+{
+	void *node = get_page(pager, page_num);
+	*node_parent(node) = parent_page_num;
+	mark_page_dirty(pager, page_num);
+	unpin_page(pager, page_num);
+}
+
+uint32_t *leaf_node_num_cells(void *node)
+{
+	return (uint32_t *)((char *)node + LEAF_NODE_NUM_CELLS_OFFSET);
+}
+
+/**
+ * Page number of the next leaf to the right, 0 if this is the
+ * right-most leaf. Page 0 holds the database header, so it can
+ * never be a sibling.
+ */
+uint32_t *leaf_node_next_leaf(void *node)
+{
+	return (uint32_t *)((char *)node + LEAF_NODE_NEXT_LEAF_OFFSET);
+}
+
+/**
+ * Offset of the lowest record in the page, PAGE_SIZE if there are none
+ */
+uint32_t *leaf_node_content_start(void *node)
+{
+	return (uint32_t *)((char *)node + LEAF_NODE_CONTENT_START_OFFSET);
+}
+
+uint32_t leaf_node_slot_size(void *node)
+{
+	return LEAF_NODE_RECORD_OFFSET_SIZE + LEAF_NODE_RECORD_SIZE_SIZE + node_key_size(node);
+}
+
+void *leaf_node_slot(void *node, uint32_t cell_num)
+{
+	return (char *)node + LEAF_NODE_HEADER_SIZE + cell_num * leaf_node_slot_size(node);
+}
+
+Key leaf_node_key(void *node, uint32_t cell_num)
+{
+	return read_key(node, (char *)leaf_node_slot(node, cell_num) + LEAF_NODE_KEY_OFFSET);
+}
+
+void set_leaf_node_key(void *node, uint32_t cell_num, Key key)
+{
+	write_key(node, (char *)leaf_node_slot(node, cell_num) + LEAF_NODE_KEY_OFFSET, key);
+}
+
+uint16_t *leaf_node_record_offset(void *node, uint32_t cell_num)
+{
+	return (uint16_t *)((char *)leaf_node_slot(node, cell_num) + LEAF_NODE_RECORD_OFFSET_OFFSET);
+}
+
+uint16_t *leaf_node_record_size(void *node, uint32_t cell_num)
+{
+	return (uint16_t *)((char *)leaf_node_slot(node, cell_num) + LEAF_NODE_RECORD_SIZE_OFFSET);
+}
+
+void *leaf_node_value(void *node, uint32_t cell_num)
+{
+	return (char *)node + *leaf_node_record_offset(node, cell_num);
+}
+
+/**
+ * Bytes between the end of the slot array and the first record
+ */
+uint32_t leaf_node_gap(void *node)
+{
+	return *leaf_node_content_start(node) - LEAF_NODE_HEADER_SIZE - *leaf_node_num_cells(node) * leaf_node_slot_size(node);
+}
+
+/**
+ * Bytes not taken by slots or records, including the holes left
+ * behind by records that were removed or moved
+ */
+uint32_t leaf_node_free_space(void *node)
+{
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	uint32_t used = num_cells * leaf_node_slot_size(node);
+	for (uint32_t i = 0; i < num_cells; i++)
+	{
+		used += *leaf_node_record_size(node, i);
+	}
+	return LEAF_NODE_SPACE_FOR_CELLS - used;
+}
+
+/**
+ * Pack all records against the end of the page so the free space
+ * is one contiguous gap again
+ */
+void leaf_node_defragment(void *node)
+{
+	char copy[PAGE_SIZE];
+	memcpy(copy, node, PAGE_SIZE);
+
+	uint32_t content_start = PAGE_SIZE;
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	for (uint32_t i = 0; i < num_cells; i++)
+	{
+		uint16_t size = *leaf_node_record_size(node, i);
+		content_start -= size;
+		memcpy((char *)node + content_start, copy + *leaf_node_record_offset(node, i), size);
+		*leaf_node_record_offset(node, i) = content_start;
+	}
+	*leaf_node_content_start(node) = content_start;
+}
+
+/**
+ * Insert a cell at cell_num. The caller makes sure it fits.
+ */
+void leaf_node_insert_cell(void *node, uint32_t cell_num, Key key, const void *record, uint32_t size)
+{
+	uint32_t slot_size = leaf_node_slot_size(node);
+	if (leaf_node_gap(node) < slot_size + size)
+	{
+		leaf_node_defragment(node);
+	}
+
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	if (cell_num < num_cells)
+	{
+		// Make room for new slot
+		memmove(leaf_node_slot(node, cell_num + 1), leaf_node_slot(node, cell_num), (num_cells - cell_num) * slot_size);
+	}
+
+	*leaf_node_content_start(node) -= size;
+	memcpy((char *)node + *leaf_node_content_start(node), record, size);
+
+	set_leaf_node_key(node, cell_num, key);
+	*leaf_node_record_offset(node, cell_num) = *leaf_node_content_start(node);
+	*leaf_node_record_size(node, cell_num) = size;
+	*leaf_node_num_cells(node) = num_cells + 1;
+}
+
+/**
+ * Remove the cell at cell_num. Unless the record was the lowest in
+ * the page it leaves a hole behind, which leaf_node_defragment
+ * reclaims once the space is needed.
+ */
+void leaf_node_remove_cell(void *node, uint32_t cell_num)
+{
+	uint32_t num_cells = *leaf_node_num_cells(node);
+
+	if (*leaf_node_record_offset(node, cell_num) == *leaf_node_content_start(node))
+	{
+		*leaf_node_content_start(node) += *leaf_node_record_size(node, cell_num);
+	}
+
+	memmove(leaf_node_slot(node, cell_num), leaf_node_slot(node, cell_num + 1), (num_cells - cell_num - 1) * leaf_node_slot_size(node));
+	*leaf_node_num_cells(node) = num_cells - 1;
+}
+
+uint32_t *internal_node_num_keys(void *node)
+{
+	return (uint32_t *)((char *)node + INTERNAL_NODE_NUM_KEYS_OFFSET);
+}
+
+uint32_t *internal_node_right_child(void *node)
+{
+	return (uint32_t *)((char *)node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
+}
+
+uint32_t internal_node_cell_size(void *node)
+{
+	return INTERNAL_NODE_CHILD_SIZE + node_key_size(node);
+}
+
+uint32_t internal_node_max_keys(void *node)
+{
+	return INTERNAL_NODE_SPACE_FOR_CELLS / internal_node_cell_size(node);
+}
+
+uint32_t internal_node_min_keys(void *node)
+{
+	return internal_node_max_keys(node) / 3;
+}
+
+uint32_t *internal_node_cell(void *node, uint32_t cell_num)
+{
+	return (uint32_t *)((char *)node + INTERNAL_NODE_HEADER_SIZE + cell_num * internal_node_cell_size(node));
+}
+
+uint32_t *internal_node_child(void *node, uint32_t child_num)
+{
+	uint32_t num_keys = *internal_node_num_keys(node);
+	if (child_num > num_keys)
+	{
+		printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
+		exit(EXIT_FAILURE);
+	}
+	else if (child_num == num_keys)
+	{
+		return internal_node_right_child(node);
+	}
+
+	return internal_node_cell(node, child_num);
+}
+
+Key internal_node_key(void *node, uint32_t key_num)
+{
+	return read_key(node, (char *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE);
+}
+
+void set_internal_node_key(void *node, uint32_t key_num, Key key)
+{
+	write_key(node, (char *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE, key);
+}
+
+void initialize_leaf_node(void *node, bool is_index)
+{
+	set_node_type(node, NODE_LEAF);
+	set_node_index(node, is_index);
+	set_node_root(node, false);
+	*leaf_node_num_cells(node) = 0;
+	*leaf_node_next_leaf(node) = 0;
+	*leaf_node_content_start(node) = PAGE_SIZE;
+}
+
+void initialize_internal_node(void *node, bool is_index)
+{
+	set_node_type(node, NODE_INTERNAL);
+	set_node_index(node, is_index);
+	set_node_root(node, false);
+	*internal_node_num_keys(node) = 0;
+	*internal_node_right_child(node) = INVALID_PAGE_NUM;
+}
+
+/**
+ * Largest key stored in the subtree rooted at node.
+ * Internal nodes only track the max of their left children,
+ * so the right-most path has to be walked down to a leaf.
+ */
+Key get_node_max_key(Pager *pager, void *node)
+{
+	if (get_node_type(node) == NODE_LEAF)
+	{
+		return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+	}
+
+	uint32_t right_child_page_num = *internal_node_right_child(node);
+	void *right_child = get_page(pager, right_child_page_num);
+	Key max_key = get_node_max_key(pager, right_child);
+	unpin_page(pager, right_child_page_num);
+
+	return max_key;
+}
+
+uint32_t *free_list_next_trunk(void *page)
+{
+	return (uint32_t *)((char *)page + FREE_LIST_NEXT_TRUNK_OFFSET);
+}
+
+uint32_t *free_list_num_leaves(void *page)
+{
+	return (uint32_t *)((char *)page + FREE_LIST_NUM_LEAVES_OFFSET);
+}
+
+uint32_t *free_list_leaf(void *page, uint32_t leaf_num)
+{
+	return (uint32_t *)((char *)page + FREE_LIST_HEADER_SIZE + leaf_num * FREE_LIST_LEAF_SIZE);
+}
+
+/**
+ * Take a page off the free list, or the next page past the end of
+ * the file if the list is empty. The caller must get_page the new
+ * page right away and initialize all of it.
+ */
+uint32_t pager_allocate_page(Pager *pager)
+{
+	DbHeader *header = (DbHeader *)get_page(pager, DB_HEADER_PAGE_NUM);
+	uint32_t page_num;
+
+	if (header->freeListTrunk == 0)
+	{
+		page_num = pager->numPages;
+	}
+	else
+	{
+		uint32_t trunk_page_num = header->freeListTrunk;
+		void *trunk = get_page(pager, trunk_page_num);
+		uint32_t num_leaves = *free_list_num_leaves(trunk);
+
+		if (num_leaves > 0)
+		{
+			page_num = *free_list_leaf(trunk, num_leaves - 1);
+			*free_list_num_leaves(trunk) = num_leaves - 1;
+			mark_page_dirty(pager, trunk_page_num);
+		}
+		else
+		{
+			// Nothing left on this trunk, reuse the trunk itself
+			page_num = trunk_page_num;
+			header->freeListTrunk = *free_list_next_trunk(trunk);
+		}
+		unpin_page(pager, trunk_page_num);
+
+		header->freePageCount -= 1;
+		mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+	}
+
+	unpin_page(pager, DB_HEADER_PAGE_NUM);
+	return page_num;
+}
+
+/**
+ * Put a page on the free list. The page must not be pinned or
+ * referenced from the tree any more.
+ */
+void pager_free_page(Pager *pager, uint32_t page_num)
+{
+	DbHeader *header = (DbHeader *)get_page(pager, DB_HEADER_PAGE_NUM);
+	uint32_t trunk_page_num = header->freeListTrunk;
+	void *trunk = trunk_page_num != 0 ? get_page(pager, trunk_page_num) : NULL;
+
+	if (trunk != NULL && *free_list_num_leaves(trunk) < FREE_LIST_TRUNK_MAX_LEAVES)
+	{
+		*free_list_leaf(trunk, *free_list_num_leaves(trunk)) = page_num;
+		*free_list_num_leaves(trunk) += 1;
+		mark_page_dirty(pager, trunk_page_num);
+	}
+	else
+	{
+		// The head trunk is full, the freed page becomes the new head
+		void *page = get_page(pager, page_num);
+		*free_list_next_trunk(page) = trunk_page_num;
+		*free_list_num_leaves(page) = 0;
+		mark_page_dirty(pager, page_num);
+		unpin_page(pager, page_num);
+		header->freeListTrunk = page_num;
+	}
+
+	if (trunk != NULL)
+	{
+		unpin_page(pager, trunk_page_num);
+	}
+
+	header->freePageCount += 1;
+	mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+	unpin_page(pager, DB_HEADER_PAGE_NUM);
+}
+
+/**
+ * Binary search the leaf for key. Return the position of the key,
+ * or the position of the first larger key, which is where a new
+ * cell with that key belongs.
+ */
+Cursor *leaf_node_find(Table *table, uint32_t page_num, Key key)
+{
+	void *node = get_page(table->pager, page_num);
+	uint32_t num_cells = *leaf_node_num_cells(node);
+
+	Cursor *cursor = new Cursor();
+	cursor->table = table;
+	cursor->page_num = page_num;
+	cursor->endOfTable = false;
+
+	uint32_t min_index = 0;
+	uint32_t one_past_max_index = num_cells;
+	while (one_past_max_index != min_index)
+	{
+		uint32_t index = (min_index + one_past_max_index) / 2;
+		Key key_at_index = leaf_node_key(node, index);
+		if (key == key_at_index)
+		{
+			min_index = index;
+			break;
+		}
+		if (key < key_at_index)
+		{
+			one_past_max_index = index;
+		}
+		else
+		{
+			min_index = index + 1;
+		}
+	}
+
+	unpin_page(table->pager, page_num);
+
+	cursor->cell_num = min_index;
+	return cursor;
+}
+
+/**
+ * Return the index of the child which should contain the given key.
+ * Key i is the largest key in child i, so binary search for the
+ * first key >= key. The right child has index num_keys.
+ */
+uint32_t internal_node_find_child(void *node, Key key)
+{
+	uint32_t num_keys = *internal_node_num_keys(node);
+
+	uint32_t min_index = 0;
+	uint32_t max_index = num_keys; // there is one more child than key
+
+	while (min_index != max_index)
+	{
+		uint32_t index = (min_index + max_index) / 2;
+		Key key_to_right = internal_node_key(node, index);
+		if (key_to_right >= key)
+		{
+			max_index = index;
+		}
+		else
+		{
+			min_index = index + 1;
+		}
+	}
+
+	return min_index;
+}
+
+/**
+ * Descend from the root to the leaf that should hold key
+ * and return a cursor to the position of key in that leaf.
+ */
+Cursor *table_find(Table *table, Key key)
+{
+	uint32_t page_num = table->root_page_num;
+	void *node = get_page(table->pager, page_num);
+
+	while (get_node_type(node) == NODE_INTERNAL)
+	{
+		uint32_t child_index = internal_node_find_child(node, key);
+		uint32_t child_page_num = *internal_node_child(node, child_index);
+		unpin_page(table->pager, page_num);
+		page_num = child_page_num;
+		node = get_page(table->pager, page_num);
+	}
+
+	unpin_page(table->pager, page_num);
+	return leaf_node_find(table, page_num, key);
+}
+
+/**
+ * table_find for keys that come in ascending order. The previous
+ * cursor, which is deleted, stays in its leaf as long as key still
+ * belongs there, so a run of keys for one leaf descends only once.
+ * A leaf that was split keeps the lower half of its keys, and a
+ * root leaf that was split is no leaf any more, so either way the
+ * check still holds after inserting at the previous cursor.
+ */
+Cursor *table_find_next(Table *table, Cursor *cursor, Key key)
+{
+	if (cursor == NULL)
+	{
+		return table_find(table, key);
+	}
+
+	uint32_t page_num = cursor->page_num;
+	delete cursor;
+
+	void *node = get_page(table->pager, page_num);
+	bool stay = false;
+	if (get_node_type(node) == NODE_LEAF)
+	{
+		uint32_t num_cells = *leaf_node_num_cells(node);
+		stay = *leaf_node_next_leaf(node) == 0 || (num_cells > 0 && key <= leaf_node_key(node, num_cells - 1));
+	}
+	unpin_page(table->pager, page_num);
+
+	return stay ? leaf_node_find(table, page_num, key) : table_find(table, key);
+}
+
+/**
+ * Copy logged page images into the database file and sync it.
+ */
+void pager_copy_frames(Pager *pager, vector<pair<uint32_t, off_t>> &frames)
+{
+	if (frames.empty())
+	{
+		return;
+	}
+
+	void *buffer = malloc(PAGE_SIZE);
+	for (uint32_t i = 0; i < frames.size(); i++)
+	{
+		wal_read_page(pager->wal, frames[i].second, buffer);
+		pager_write_page(pager, frames[i].first, buffer);
+	}
+	free(buffer);
+
+	if (fsync(pager->file_descriptor) == -1)
+	{
+		printf("Error syncing db file: %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Copy the latest committed image of every logged page into the
+ * database file, sync it and start the log over.
+ *
+ * Frames before the last commit never change until the log is
+ * reset, so the bulk of the copy runs without the log lock and
+ * statements keep going meanwhile. Whatever was committed during
+ * the copy is caught up under the lock right before the reset.
+ * If a statement has uncommitted frames in the log by then, the
+ * reset waits for the next checkpoint. Pages are read from the log
+ * rather than the buffer pool, which belongs to the main thread.
+ */
+void pager_checkpoint(Pager *pager)
+{
+	Wal *wal = pager->wal;
+	vector<pair<uint32_t, off_t>> frames;
+	off_t snapshot_end;
+
+	{
+		lock_guard<mutex> guard(wal->lock);
+		if (wal->index.empty())
+		{
+			return;
+		}
+
+		snapshot_end = wal->commitEnd;
+		for (unordered_map<uint32_t, off_t>::iterator entry = wal->index.begin(); entry != wal->index.end(); entry++)
+		{
+			if (entry->second < snapshot_end)
+			{
+				frames.push_back(*entry);
+			}
+		}
+	}
+
+	pager_copy_frames(pager, frames);
+
+	lock_guard<mutex> guard(wal->lock);
+	if (wal->lastLsn != wal->commitLsn)
+	{
+		return;
+	}
+
+	frames.clear();
+	for (unordered_map<uint32_t, off_t>::iterator entry = wal->index.begin(); entry != wal->index.end(); entry++)
+	{
+		if (entry->second >= snapshot_end)
+		{
+			frames.push_back(*entry);
+		}
+	}
+	pager_copy_frames(pager, frames);
+
+	wal_reset(wal);
+	wal->checkpoints += 1;
+}
+
+void checkpointer_run(Pager *pager)
+{
+	Checkpointer *checkpointer = pager->checkpointer;
+	unique_lock<mutex> guard(checkpointer->lock);
+
+	while (true)
+	{
+		checkpointer->wakeup.wait_for(guard, chrono::milliseconds(checkpointer->intervalMs), [checkpointer]
+									  { return checkpointer->stop || checkpointer->requested; });
+		if (checkpointer->stop)
+		{
+			return;
+		}
+		checkpointer->requested = false;
+
+		guard.unlock();
+		pager_checkpoint(pager);
+		guard.lock();
+	}
+}
+
+void checkpointer_start(Pager *pager, uint32_t interval_ms)
+{
+	Checkpointer *checkpointer = new Checkpointer();
+	checkpointer->stop = false;
+	checkpointer->requested = false;
+	checkpointer->intervalMs = interval_ms;
+
+	pager->checkpointer = checkpointer;
+	checkpointer->worker = thread(checkpointer_run, pager);
+}
+
+/**
+ * Wake the checkpointer before its interval is up
+ */
+void checkpointer_request(Pager *pager)
+{
+	Checkpointer *checkpointer = pager->checkpointer;
+	{
+		lock_guard<mutex> guard(checkpointer->lock);
+		checkpointer->requested = true;
+	}
+	checkpointer->wakeup.notify_one();
+}
+
+void checkpointer_stop(Pager *pager)
+{
+	Checkpointer *checkpointer = pager->checkpointer;
+	if (checkpointer == NULL)
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> guard(checkpointer->lock);
+		checkpointer->stop = true;
+	}
+	checkpointer->wakeup.notify_one();
+	checkpointer->worker.join();
+
+	delete checkpointer;
+	pager->checkpointer = NULL;
+}
+
+/**
+ * Commit every change since the last commit. Dirty pages are
+ * appended to the log, the last one marked as the commit. The
+ * commit is durable once the log is synced up to the returned LSN.
+ * Changes never reach the database file here.
+ */
+uint64_t pager_log_commit(Pager *pager)
+{
+	Wal *wal = pager->wal;
+	vector<uint32_t> dirty_pages;
+
+	for (uint32_t i = 0; i < pager->mappedPages; i++)
+	{
+		if (pager->mappedDirty[i])
+		{
+			dirty_pages.push_back(i);
+		}
+	}
+	for (unordered_map<uint32_t, uint32_t>::iterator entry = pager->pageTable.begin(); entry != pager->pageTable.end(); entry++)
+	{
+		if (pager->frames[entry->second].dirty)
+		{
+			dirty_pages.push_back(entry->first);
+		}
+	}
+
+	if (dirty_pages.empty())
+	{
+		if (wal->lastLsn == wal->commitLsn)
+		{
+			// Nothing changed
+			return wal->commitLsn;
+		}
+
+		// Everything was already spilled by eviction, the commit mark still needs a frame
+		get_page(pager, 0);
+		dirty_pages.push_back(0);
+		unpin_page(pager, 0);
+	}
+
+	sort(dirty_pages.begin(), dirty_pages.end());
+
+	for (uint32_t i = 0; i < dirty_pages.size(); i++)
+	{
+		uint32_t page_num = dirty_pages[i];
+		bool dirty;
+		void *data = pager_cached_page(pager, page_num, &dirty);
+		uint32_t commit_size = (i == dirty_pages.size() - 1) ? pager->numPages : 0;
+
+		wal_append(wal, page_num, data, commit_size);
+
+		if (page_num < pager->mappedPages)
+		{
+			pager->mappedDirty[page_num] = false;
+		}
+		else
+		{
+			pager->frames[pager->pageTable[page_num]].dirty = false;
+		}
+	}
+
+	if (pager->checkpointer != NULL && wal_num_frames(wal) >= WAL_CHECKPOINT_FRAMES)
+	{
+		checkpointer_request(pager);
+	}
+
+	return wal->commitLsn;
+}
+
+void pager_commit(Pager *pager)
+{
+	wal_sync_to(pager->wal, pager_log_commit(pager));
+}
+
+PlanCache *planCacheNew(uint32_t capacity);
+void planCacheClear(PlanCache *cache);
+void loadSchema(Database *db);
+
+/**
+ * Without commit, whatever changed since the last commit is dropped.
+ * The log is kept then, pages that eviction spilled into it are
+ * uncommitted frames that the next db_open discards.
+ */
+void db_close(Database *db, bool commit)
+{
+	Pager *pager = db->pager;
+	Wal *wal = pager->wal;
+
+	// Prepared selects may still hold cursors into the tree
+	planCacheClear(db->planCache);
+	delete db->planCache;
+
+	checkpointer_stop(pager);
+	if (commit)
+	{
+		pager_commit(pager);
+		pager_checkpoint(pager);
+
+		// Everything is in the database file, the log is no longer needed
+		unlink(wal->path.c_str());
+	}
+	close(wal->file_descriptor);
+	delete wal;
+
+	if (pager->map != NULL)
+	{
+		munmap(pager->map, (size_t)pager->mappedPages * PAGE_SIZE);
+	}
+
+	int result = close(pager->file_descriptor);
+	if (result == -1)
+	{
+		cout << "Error closing db file." << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	free(pager->frames[0].data);
+	delete[] pager->frames;
+	delete pager;
+}
+
+Pager *pager_open(const char *filename, DbOptions *options)
+{
+	int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+
+	if (fd == -1)
+	{
+		cout << "Unable to open file" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	off_t file_length = lseek(fd, 0, SEEK_END);
+	Pager *pager = new Pager();
+	pager->file_descriptor = fd;
+	pager->file_length = file_length;
+	pager->numPages = (file_length / PAGE_SIZE);
+
+	if (file_length % PAGE_SIZE != 0)
+	{
+		printf("Db file is not a whole number of pages. Corrupt file.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	pager->mode = options->pagerMode;
+	pager->map = NULL;
+	pager->mappedPages = 0;
+	pager->pagesRead = 0;
+	pager->pagesWritten = 0;
+
+	// All frames share one allocation
+	uint32_t num_frames = options->poolFrames;
+	char *frame_data = (char *)malloc((size_t)num_frames * PAGE_SIZE);
+	pager->numFrames = num_frames;
+	pager->frames = new Frame[num_frames];
+	for (uint32_t i = 0; i < num_frames; i++)
+	{
+		pager->frames[i].data = frame_data + (size_t)i * PAGE_SIZE;
+		pager->frames[i].pin_count = 0;
+		pager->frames[i].dirty = false;
+		pager->freeFrames.push_back(num_frames - 1 - i);
+	}
+
+	/**
+	 * Redo recovery. Whatever the log holds from committed
+	 * transactions of an earlier session is copied into the
+	 * database file before anything reads from it.
+	 */
+	pager->wal = wal_open(filename);
+	uint32_t committed_num_pages = wal_recover(pager->wal);
+	if (committed_num_pages > pager->numPages)
+	{
+		pager->numPages = committed_num_pages;
+	}
+	pager_checkpoint(pager);
+	if (ftruncate(pager->wal->file_descriptor, pager->wal->end) == -1)
+	{
+		printf("Error truncating wal: %d\n", errno);
+		exit(EXIT_FAILURE);
+	}
+
+	if (pager->mode == PAGER_MMAP && pager->numPages > 0)
+	{
+		void *map = mmap(NULL, (size_t)pager->numPages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+		{
+			printf("Error mapping db file: %d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+		pager->map = (char *)map;
+		pager->mappedPages = pager->numPages;
+		pager->mappedDirty.assign(pager->mappedPages, false);
+	}
+
+	pager->checkpointer = NULL;
+	if (options->checkpointIntervalMs > 0)
+	{
+		checkpointer_start(pager, options->checkpointIntervalMs);
+	}
+
+	return pager;
+}
+
+Database *db_open(const char *filename, DbOptions *options)
+{
+	Pager *pager = pager_open(filename, options);
+
+	Database *db = new Database();
+	db->pager = pager;
+	db->planCache = planCacheNew(PLAN_CACHE_SIZE);
+
+	if (pager->numPages == 0)
+	{
+		/**
+		 * New database file.
+		 * Write the header to page 0 and initialize page 1
+		 * as the root leaf node of the schema table.
+		 */
+		DbHeader *header = (DbHeader *)get_page(pager, DB_HEADER_PAGE_NUM);
+		header->magic = DB_MAGIC;
+		header->pageSize = PAGE_SIZE;
+		header->freeListTrunk = 0;
+		header->freePageCount = 0;
+		mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+		unpin_page(pager, DB_HEADER_PAGE_NUM);
+
+		void *root_node = get_page(pager, SCHEMA_ROOT_PAGE_NUM);
+		initialize_leaf_node(root_node, false);
+		set_node_root(root_node, true);
+		mark_page_dirty(pager, SCHEMA_ROOT_PAGE_NUM);
+		unpin_page(pager, SCHEMA_ROOT_PAGE_NUM);
+	}
+
+	DbHeader *header = (DbHeader *)get_page(pager, DB_HEADER_PAGE_NUM);
+	if (header->magic != DB_MAGIC || header->pageSize != PAGE_SIZE)
+	{
+		printf("File is not a database or was written by an incompatible version.\n");
+		// Don't leave a log of our own next to a file that isn't ours
+		if (pager->wal->created)
+		{
+			unlink(pager->wal->path.c_str());
+		}
+		exit(EXIT_FAILURE);
+	}
+	unpin_page(pager, DB_HEADER_PAGE_NUM);
+
+	loadSchema(db);
+
+	return db;
+}
+
+uint32_t *overflow_next_page(void *page)
+{
+	return (uint32_t *)((char *)page + OVERFLOW_NEXT_PAGE_OFFSET);
+}
+
+/**
+ * Copy a value into a new chain of overflow pages, returns the
+ * first page of the chain
+ */
+uint32_t overflow_write(Pager *pager, const string &value)
+{
+	uint32_t first_page_num = pager_allocate_page(pager);
+	uint32_t page_num = first_page_num;
+
+	for (size_t offset = 0; offset < value.size(); offset += OVERFLOW_SPACE_FOR_DATA)
+	{
+		size_t chunk = min((size_t)OVERFLOW_SPACE_FOR_DATA, value.size() - offset);
+		void *page = get_page(pager, page_num);
+		memcpy((char *)page + OVERFLOW_HEADER_SIZE, value.data() + offset, chunk);
+
+		uint32_t next_page_num = offset + chunk < value.size() ? pager_allocate_page(pager) : 0;
+		*overflow_next_page(page) = next_page_num;
+
+		mark_page_dirty(pager, page_num);
+		unpin_page(pager, page_num);
+		page_num = next_page_num;
+	}
+
+	return first_page_num;
+}
+
+void overflow_read(Pager *pager, uint32_t page_num, uint32_t length, string *value)
+{
+	value->resize(length);
+
+	for (size_t offset = 0; offset < length; offset += OVERFLOW_SPACE_FOR_DATA)
+	{
+		size_t chunk = min((size_t)OVERFLOW_SPACE_FOR_DATA, length - offset);
+		void *page = get_page(pager, page_num);
+		memcpy(&((*value)[offset]), (char *)page + OVERFLOW_HEADER_SIZE, chunk);
+
+		uint32_t next_page_num = *overflow_next_page(page);
+		unpin_page(pager, page_num);
+		page_num = next_page_num;
+	}
+}
+
+/**
+ * Shortest text that reads back as the same double, with a
+ * decimal point so it never looks like an INTEGER
+ */
+string formatReal(double value)
+{
+	char buffer[32];
+	char *end = to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+	string text(buffer, end);
+	if (text.find_first_of(".e") == string::npos)
+	{
+		text += ".0";
+	}
+	return text;
+}
+
+/**
+ * Size of the encoded column at the start of source
+ */
+uint32_t columnSize(Column *column, const char *source)
+{
+	if (column->type == COLUMN_INTEGER || column->type == COLUMN_REAL)
+	{
+		return COLUMN_NUMBER_SIZE;
+	}
+
+	uint16_t length;
+	memcpy(&length, source, COLUMN_LENGTH_SIZE);
+
+	if (length == COLUMN_OVERFLOW)
+	{
+		return COLUMN_LENGTH_SIZE + COLUMN_OVERFLOW_LENGTH_SIZE + COLUMN_OVERFLOW_PAGE_SIZE;
+	}
+	return COLUMN_LENGTH_SIZE + length;
+}
+
+/**
+ * Largest record the columns of a table can take, with every
+ * TEXT and BLOB as long as it can be and still stay in the leaf
+ */
+uint32_t recordMaxSize(vector<Column> &columns)
+{
+	uint32_t size = 0;
+	for (uint32_t i = 1; i < columns.size(); i++)
+	{
+		if (columns[i].type == COLUMN_INTEGER || columns[i].type == COLUMN_REAL)
+		{
+			size += COLUMN_NUMBER_SIZE;
+		}
+		else
+		{
+			size += COLUMN_LENGTH_SIZE + max(min(columns[i].maxLength, COLUMN_MAX_LOCAL_SIZE), COLUMN_OVERFLOW_LENGTH_SIZE + COLUMN_OVERFLOW_PAGE_SIZE);
+		}
+	}
+	return size;
+}
+
+/**
+ * Encode one column, returns its size. Long values are written to
+ * overflow pages first.
+ */
+uint32_t serializeColumn(Pager *pager, Column *column, const string &value, char *destination)
+{
+	if (column->type == COLUMN_INTEGER)
+	{
+		int64_t number = strtoll(value.c_str(), NULL, 10);
+		memcpy(destination, &number, COLUMN_NUMBER_SIZE);
+	}
+	else if (column->type == COLUMN_REAL)
+	{
+		double number = strtod(value.c_str(), NULL);
+		memcpy(destination, &number, COLUMN_NUMBER_SIZE);
+	}
+	else if (value.length() > COLUMN_MAX_LOCAL_SIZE)
+	{
+		uint32_t length = value.length();
+		uint32_t first_page_num = overflow_write(pager, value);
+		memcpy(destination, &COLUMN_OVERFLOW, COLUMN_LENGTH_SIZE);
+		memcpy(destination + COLUMN_LENGTH_SIZE, &length, COLUMN_OVERFLOW_LENGTH_SIZE);
+		memcpy(destination + COLUMN_LENGTH_SIZE + COLUMN_OVERFLOW_LENGTH_SIZE, &first_page_num, COLUMN_OVERFLOW_PAGE_SIZE);
+	}
+	else
+	{
+		uint16_t length = value.length();
+		memcpy(destination, &length, COLUMN_LENGTH_SIZE);
+		memcpy(destination + COLUMN_LENGTH_SIZE, value.data(), length);
+	}
+
+	return columnSize(column, destination);
+}
+
+void deserializeColumn(Pager *pager, Column *column, const char *source, string *value)
+{
+	if (column->type == COLUMN_INTEGER)
+	{
+		int64_t number;
+		memcpy(&number, source, COLUMN_NUMBER_SIZE);
+		*value = to_string(number);
+		return;
+	}
+	if (column->type == COLUMN_REAL)
+	{
+		double number;
+		memcpy(&number, source, COLUMN_NUMBER_SIZE);
+		*value = formatReal(number);
+		return;
+	}
+
+	uint16_t length;
+	memcpy(&length, source, COLUMN_LENGTH_SIZE);
+
+	if (length == COLUMN_OVERFLOW)
+	{
+		uint32_t overflow_length;
+		uint32_t first_page_num;
+		memcpy(&overflow_length, source + COLUMN_LENGTH_SIZE, COLUMN_OVERFLOW_LENGTH_SIZE);
+		memcpy(&first_page_num, source + COLUMN_LENGTH_SIZE + COLUMN_OVERFLOW_LENGTH_SIZE, COLUMN_OVERFLOW_PAGE_SIZE);
+		overflow_read(pager, first_page_num, overflow_length, value);
+		return;
+	}
+
+	value->assign(source + COLUMN_LENGTH_SIZE, length);
+}
+
+/**
+ * Put the overflow pages of a column that is going away on the
+ * free list
+ */
+void freeColumnOverflow(Pager *pager, Column *column, const char *source)
+{
+	if (column->type == COLUMN_INTEGER || column->type == COLUMN_REAL)
+	{
+		return;
+	}
+
+	uint16_t length;
+	memcpy(&length, source, COLUMN_LENGTH_SIZE);
+	if (length != COLUMN_OVERFLOW)
+	{
+		return;
+	}
+
+	uint32_t page_num;
+	memcpy(&page_num, source + COLUMN_LENGTH_SIZE + COLUMN_OVERFLOW_LENGTH_SIZE, COLUMN_OVERFLOW_PAGE_SIZE);
+	while (page_num != 0)
+	{
+		void *page = get_page(pager, page_num);
+		uint32_t next_page_num = *overflow_next_page(page);
+		unpin_page(pager, page_num);
+		pager_free_page(pager, page_num);
+		page_num = next_page_num;
+	}
+}
+
+/**
+ * Write the record for a row of table, returns its size
+ */
+uint32_t serializeRow(Table *table, Row *source, void *destination)
+{
+	char *record = (char *)destination;
+
+	for (uint32_t i = 1; i < table->columns.size(); i++)
+	{
+		record += serializeColumn(table->pager, &(table->columns[i]), source->values[i - 1], record);
+	}
+
+	return record - (char *)destination;
+}
+
+/**
+ * Read the columns of a record that are set in columns, by column,
+ * or all of them if it is NULL, back into a row. The other values
+ * of the row are left as they are. Overflow pages are only read
+ * here, so the pages of a column that isn't asked for are never
+ * touched.
+ */
+void deserializeRow(Table *table, void *source, Row *destination, const vector<bool> *columns)
+{
+	char *record = (char *)source;
+	destination->values.resize(table->columns.size() - 1);
+
+	for (uint32_t i = 1; i < table->columns.size(); i++)
+	{
+		if (columns == NULL || (*columns)[i])
+		{
+			deserializeColumn(table->pager, &(table->columns[i]), record, &(destination->values[i - 1]));
+		}
+		record += columnSize(&(table->columns[i]), record);
+	}
+}
+
+/**
+ * Write the record of a row with the columns in replace taken from
+ * values. The other columns keep their bytes, overflow pointer
+ * included, so their overflow pages are neither read nor rewritten.
+ * Overflow pages of replaced columns are freed.
+ */
+uint32_t updateRow(Table *table, void *source, Row *values, vector<bool> &replace, void *destination)
+{
+	char *old_record = (char *)source;
+	char *record = (char *)destination;
+
+	for (uint32_t i = 1; i < table->columns.size(); i++)
+	{
+		Column *column = &(table->columns[i]);
+		uint32_t old_size = columnSize(column, old_record);
+		if (replace[i])
+		{
+			freeColumnOverflow(table->pager, column, old_record);
+			record += serializeColumn(table->pager, column, values->values[i - 1], record);
+		}
+		else
+		{
+			memcpy(record, old_record, old_size);
+			record += old_size;
+		}
+		old_record += old_size;
+	}
+
+	return record - (char *)destination;
+}
+
+/**
+ * Put the overflow pages of a record that is going away on the
+ * free list
+ */
+void freeRowOverflow(Table *table, void *source)
+{
+	char *record = (char *)source;
+
+	for (uint32_t i = 1; i < table->columns.size(); i++)
+	{
+		freeColumnOverflow(table->pager, &(table->columns[i]), record);
+		record += columnSize(&(table->columns[i]), record);
+	}
+}
+
+/**
+ * Value part of an index key: the first INDEX_KEY_VALUE_SIZE bytes
+ * of text, with pad in place of any it is short of
+ */
+Key indexTextKey(string_view text, uint8_t pad)
+{
+	Key key = 0;
+	for (uint32_t i = 0; i < INDEX_KEY_VALUE_SIZE; i++)
+	{
+		key = key << 8 | (i < text.length() ? (uint8_t)text[i] : pad);
+	}
+	return key << 32;
+}
+
+/**
+ * Value part of the index key of a value of column. Numbers are
+ * written big-endian with the sign bit flipped, and all other bits
+ * too for negative REALs, so their bytes sort like the numbers do.
+ */
+Key indexValueKey(Column *column, const string &value)
+{
+	uint64_t bits;
+	if (column->type == COLUMN_INTEGER)
+	{
+		bits = (uint64_t)strtoll(value.c_str(), NULL, 10) ^ (1ULL << 63);
+	}
+	else if (column->type == COLUMN_REAL)
+	{
+		double number = strtod(value.c_str(), NULL);
+		if (number == 0)
+		{
+			// -0.0 is equal to 0.0, so it needs the same key
+			number = 0;
+		}
+		memcpy(&bits, &number, sizeof(bits));
+		bits = (bits >> 63) != 0 ? ~bits : bits | (1ULL << 63);
+	}
+	else
+	{
+		return indexTextKey(value, 0);
+	}
+
+	char bytes[sizeof(bits)];
+	for (uint32_t i = 0; i < sizeof(bits); i++)
+	{
+		bytes[i] = (char)(bits >> (8 * (sizeof(bits) - 1 - i)));
+	}
+	return indexTextKey(string_view(bytes, sizeof(bytes)), 0);
+}
+
+/**
+ * The entry of a row in an index, as a row of the index tree, and
+ * its key
+ */
+Key indexEntry(Index *index, Row *row, Row *entry)
+{
+	entry->id = row->id;
+	entry->values.clear();
+	for (uint32_t i = 0; i < index->columns.size(); i++)
+	{
+		entry->values.push_back(row->values[index->columns[i] - 1]);
+	}
+	return indexValueKey(&(index->table->columns[index->columns[0]]), entry->values[0]) | row->id;
+}
+
+/**
+ * Handle splitting the root.
+ * Old root copied to new page, becomes left child.
+ * Address of right child passed in.
+ * Re-initialize root page to contain the new root node.
+ * New root node points to two children.
+ */
+void create_new_root(Table *table, uint32_t right_child_page_num)
+{
+	Pager *pager = table->pager;
+	void *root = get_page(pager, table->root_page_num);
+	void *right_child = get_page(pager, right_child_page_num);
+	uint32_t left_child_page_num = pager_allocate_page(pager);
+	void *left_child = get_page(pager, left_child_page_num);
+
+	// Left child has data copied from old root
+	memcpy(left_child, root, PAGE_SIZE);
+	set_node_root(left_child, false);
+
+	if (get_node_type(left_child) == NODE_INTERNAL)
+	{
+		// Children of the old root now hang off the left child
+		for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++)
+		{
+			update_node_parent(pager, *internal_node_child(left_child, i), left_child_page_num);
+		}
+	}
+
+	// Root node is a new internal node with one key and two children
+	initialize_internal_node(root, is_index_node(left_child));
+	set_node_root(root, true);
+	*internal_node_num_keys(root) = 1;
+	*internal_node_child(root, 0) = left_child_page_num;
+	set_internal_node_key(root, 0, get_node_max_key(pager, left_child));
+	*internal_node_right_child(root) = right_child_page_num;
+	*node_parent(left_child) = table->root_page_num;
+	*node_parent(right_child) = table->root_page_num;
+
+	mark_page_dirty(pager, left_child_page_num);
+	mark_page_dirty(pager, right_child_page_num);
+	mark_page_dirty(pager, table->root_page_num);
+	unpin_page(pager, left_child_page_num);
+	unpin_page(pager, right_child_page_num);
+	unpin_page(pager, table->root_page_num);
+}
+
+void update_internal_node_key(void *node, Key old_key, Key new_key)
+{
+	uint32_t old_child_index = internal_node_find_child(node, old_key);
+
+	// The right child has no key of its own
+	if (old_child_index < *internal_node_num_keys(node))
+	{
+		set_internal_node_key(node, old_child_index, new_key);
+	}
+}
+
+void internal_node_split_and_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num);
+
+/**
+ * Add a new child/key pair to parent that corresponds to child
+ */
+void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
+{
+	Pager *pager = table->pager;
+	void *parent = get_page(pager, parent_page_num);
+	void *child = get_page(pager, child_page_num);
+	Key child_max_key = get_node_max_key(pager, child);
+	uint32_t index = internal_node_find_child(parent, child_max_key);
+	uint32_t original_num_keys = *internal_node_num_keys(parent);
+	uint32_t right_child_page_num = *internal_node_right_child(parent);
+
+	if (original_num_keys >= internal_node_max_keys(parent))
+	{
+		unpin_page(pager, child_page_num);
+		unpin_page(pager, parent_page_num);
+		internal_node_split_and_insert(table, parent_page_num, child_page_num);
+		return;
+	}
+
+	*node_parent(child) = parent_page_num;
+	mark_page_dirty(pager, child_page_num);
+	unpin_page(pager, child_page_num);
+	mark_page_dirty(pager, parent_page_num);
+
+	if (right_child_page_num == INVALID_PAGE_NUM)
+	{
+		*internal_node_right_child(parent) = child_page_num;
+		unpin_page(pager, parent_page_num);
+		return;
+	}
+
+	void *right_child = get_page(pager, right_child_page_num);
+	Key right_child_max_key = get_node_max_key(pager, right_child);
+	unpin_page(pager, right_child_page_num);
+
+	*internal_node_num_keys(parent) = original_num_keys + 1;
+
+	if (child_max_key > right_child_max_key)
+	{
+		// Replace right child
+		*internal_node_child(parent, original_num_keys) = right_child_page_num;
+		set_internal_node_key(parent, original_num_keys, right_child_max_key);
+		*internal_node_right_child(parent) = child_page_num;
+	}
+	else
+	{
+		// Make room for the new cell
+		for (uint32_t i = original_num_keys; i > index; i--)
+		{
+			memcpy(internal_node_cell(parent, i), internal_node_cell(parent, i - 1), internal_node_cell_size(parent));
+		}
+		*internal_node_child(parent, index) = child_page_num;
+		set_internal_node_key(parent, index, child_max_key);
+	}
+
+	unpin_page(pager, parent_page_num);
+}
+
+/**
+ * Split a full internal node while adding one more child to it.
+ * The lower half of the children stay in the old node and the
+ * upper half move to a new node which is then added to the parent.
+ */
+void internal_node_split_and_insert(Table *table, uint32_t old_page_num, uint32_t child_page_num)
+{
+	Pager *pager = table->pager;
+	void *old_node = get_page(pager, old_page_num);
+	Key old_max = get_node_max_key(pager, old_node);
+	void *child = get_page(pager, child_page_num);
+	Key child_max = get_node_max_key(pager, child);
+	unpin_page(pager, child_page_num);
+
+	// Lay out all children, including the new one, in key order
+	uint32_t num_keys = *internal_node_num_keys(old_node);
+	uint32_t num_children = num_keys + 2;
+	uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+	Key keys[INTERNAL_NODE_MAX_KEYS + 2];
+
+	uint32_t index = internal_node_find_child(old_node, child_max);
+	if (index == num_keys && child_max > old_max)
+	{
+		// New child goes after the old right child
+		index = num_keys + 1;
+	}
+
+	for (uint32_t i = 0, j = 0; i < num_children; i++)
+	{
+		if (i == index)
+		{
+			children[i] = child_page_num;
+			keys[i] = child_max;
+			continue;
+		}
+		children[i] = *internal_node_child(old_node, j);
+		keys[i] = (j < num_keys) ? internal_node_key(old_node, j) : old_max;
+		j++;
+	}
+
+	uint32_t left_count = num_children / 2;
+	uint32_t new_page_num = pager_allocate_page(pager);
+	void *new_node = get_page(pager, new_page_num);
+	initialize_internal_node(new_node, is_index_node(old_node));
+
+	// Upper half goes to the new node
+	*internal_node_num_keys(new_node) = num_children - left_count - 1;
+	for (uint32_t i = left_count; i < num_children; i++)
+	{
+		*internal_node_child(new_node, i - left_count) = children[i];
+		if (i < num_children - 1)
+		{
+			set_internal_node_key(new_node, i - left_count, keys[i]);
+		}
+		update_node_parent(pager, children[i], new_page_num);
+	}
+
+	// Lower half stays in the old node
+	*internal_node_num_keys(old_node) = left_count - 1;
+	for (uint32_t i = 0; i < left_count; i++)
+	{
+		*internal_node_child(old_node, i) = children[i];
+		if (i < left_count - 1)
+		{
+			set_internal_node_key(old_node, i, keys[i]);
+		}
+		update_node_parent(pager, children[i], old_page_num);
+	}
+
+	bool splitting_root = is_node_root(old_node);
+	uint32_t parent_page_num = *node_parent(old_node);
+	*node_parent(new_node) = parent_page_num;
+	mark_page_dirty(pager, new_page_num);
+	mark_page_dirty(pager, old_page_num);
+	unpin_page(pager, new_page_num);
+	unpin_page(pager, old_page_num);
+
+	if (splitting_root)
+	{
+		create_new_root(table, new_page_num);
+	}
+	else
+	{
+		void *parent = get_page(pager, parent_page_num);
+		update_internal_node_key(parent, old_max, keys[left_count - 1]);
+		mark_page_dirty(pager, parent_page_num);
+		unpin_page(pager, parent_page_num);
+		internal_node_insert(table, parent_page_num, new_page_num);
+	}
+}
+
+/**
+ * Create a new node and move half the cells over.
+ * Insert the new value in one of the two nodes.
+ * Update parent or create a new parent.
+ */
+void leaf_node_split_and_insert(Cursor *cursor, Key key, void *record, uint32_t size)
+{
+	Pager *pager = cursor->table->pager;
+	void *old_node = get_page(pager, cursor->page_num);
+	Key old_max = get_node_max_key(pager, old_node);
+	uint32_t new_page_num = pager_allocate_page(pager);
+	void *new_node = get_page(pager, new_page_num);
+	initialize_leaf_node(new_node, is_index_node(old_node));
+	*node_parent(new_node) = *node_parent(old_node);
+	*leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+	*leaf_node_next_leaf(old_node) = new_page_num;
+
+	// All existing cells plus the new one, in key order
+	uint32_t num_cells = *leaf_node_num_cells(old_node);
+	vector<Key> keys;
+	vector<string> records;
+	for (uint32_t i = 0; i <= num_cells; i++)
+	{
+		if (i == cursor->cell_num)
+		{
+			keys.push_back(key);
+			records.push_back(string((char *)record, size));
+		}
+		if (i < num_cells)
+		{
+			keys.push_back(leaf_node_key(old_node, i));
+			records.push_back(string((char *)leaf_node_value(old_node, i), *leaf_node_record_size(old_node, i)));
+		}
+	}
+
+	/**
+	 * Records vary in size, so divide the cells by bytes rather
+	 * than by count: the old (left) node takes cells until it
+	 * holds about half of them.
+	 */
+	uint32_t slot_size = leaf_node_slot_size(old_node);
+	uint32_t total_bytes = 0;
+	for (uint32_t i = 0; i < records.size(); i++)
+	{
+		total_bytes += slot_size + records[i].size();
+	}
+	uint32_t left_count = 1;
+	uint32_t left_bytes = slot_size + records[0].size();
+	while (left_count < records.size() - 1 && left_bytes + slot_size + records[left_count].size() <= total_bytes / 2)
+	{
+		left_bytes += slot_size + records[left_count].size();
+		left_count += 1;
+	}
+
+	*leaf_node_num_cells(old_node) = 0;
+	*leaf_node_content_start(old_node) = PAGE_SIZE;
+	for (uint32_t i = 0; i < records.size(); i++)
+	{
+		void *destination_node = i < left_count ? old_node : new_node;
+		leaf_node_insert_cell(destination_node, *leaf_node_num_cells(destination_node), keys[i], records[i].data(), records[i].size());
+	}
+
+	bool splitting_root = is_node_root(old_node);
+	uint32_t parent_page_num = *node_parent(old_node);
+	Key new_max = get_node_max_key(pager, old_node);
+	mark_page_dirty(pager, new_page_num);
+	mark_page_dirty(pager, cursor->page_num);
+	unpin_page(pager, new_page_num);
+	unpin_page(pager, cursor->page_num);
+
+	if (splitting_root)
+	{
+		create_new_root(cursor->table, new_page_num);
+	}
+	else
+	{
+		void *parent = get_page(pager, parent_page_num);
+		update_internal_node_key(parent, old_max, new_max);
+		mark_page_dirty(pager, parent_page_num);
+		unpin_page(pager, parent_page_num);
+		internal_node_insert(cursor->table, parent_page_num, new_page_num);
+	}
+}
+
+/**
+ * Insert an encoded record at the cursor, splitting the leaf if it
+ * does not fit
+ */
+void leaf_node_insert_record(Cursor *cursor, Key key, void *record, uint32_t size)
+{
+	void *node = get_page(cursor->table->pager, cursor->page_num);
+	uint32_t slot_size = leaf_node_slot_size(node);
+
+	if (leaf_node_gap(node) < slot_size + size && leaf_node_free_space(node) < slot_size + size)
+	{
+		// Node full
+		unpin_page(cursor->table->pager, cursor->page_num);
+		leaf_node_split_and_insert(cursor, key, record, size);
+		return;
+	}
+
+	leaf_node_insert_cell(node, cursor->cell_num, key, record, size);
+
+	mark_page_dirty(cursor->table->pager, cursor->page_num);
+	unpin_page(cursor->table->pager, cursor->page_num);
+}
+
+void leaf_node_insert(Cursor *cursor, Key key, Row *value)
+{
+	char record[ROW_MAX_SIZE];
+	uint32_t size = serializeRow(cursor->table, value, record);
+	leaf_node_insert_record(cursor, key, record, size);
+}
+
+/**
+ * Replace the record of the cell under the cursor. A record that
+ * is no bigger is overwritten where it is. One that grew moves
+ * within the page, and only if the page has no room left is it
+ * taken out and inserted again, splitting the leaf.
+ */
+void leaf_node_update(Cursor *cursor, void *record, uint32_t size)
+{
+	Pager *pager = cursor->table->pager;
+	void *node = get_page(pager, cursor->page_num);
+	Key key = leaf_node_key(node, cursor->cell_num);
+	uint32_t old_size = *leaf_node_record_size(node, cursor->cell_num);
+
+	if (size <= old_size)
+	{
+		memcpy(leaf_node_value(node, cursor->cell_num), record, size);
+		*leaf_node_record_size(node, cursor->cell_num) = size;
+	}
+	else if (leaf_node_free_space(node) + old_size >= size)
+	{
+		leaf_node_remove_cell(node, cursor->cell_num);
+		leaf_node_insert_cell(node, cursor->cell_num, key, record, size);
+	}
+	else
+	{
+		leaf_node_remove_cell(node, cursor->cell_num);
+		mark_page_dirty(pager, cursor->page_num);
+		unpin_page(pager, cursor->page_num);
+		leaf_node_insert_record(cursor, key, record, size);
+		return;
+	}
+
+	mark_page_dirty(pager, cursor->page_num);
+	unpin_page(pager, cursor->page_num);
+}
+
+uint32_t internal_node_child_index(void *node, uint32_t child_page_num)
+{
+	uint32_t num_keys = *internal_node_num_keys(node);
+	for (uint32_t i = 0; i <= num_keys; i++)
+	{
+		if (*internal_node_child(node, i) == child_page_num)
+		{
+			return i;
+		}
+	}
+
+	printf("Page %d is not a child of its parent.\n", child_page_num);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Drop key index and the child to its left, which the caller has
+ * merged into the child to its right. The merged node takes over
+ * the place of the right child.
+ */
+void internal_node_drop_key(void *node, uint32_t index)
+{
+	uint32_t num_keys = *internal_node_num_keys(node);
+
+	*internal_node_child(node, index + 1) = *internal_node_child(node, index);
+	memmove(internal_node_cell(node, index), internal_node_cell(node, index + 1), (num_keys - index - 1) * internal_node_cell_size(node));
+	*internal_node_num_keys(node) = num_keys - 1;
+}
+
+/**
+ * Rebalance two neighbouring leaves separated by key index
+ * separator of parent. If their cells fit in one page the right
+ * leaf is merged into the left one and true is returned, otherwise
+ * cells move over from the fuller leaf until they are about even.
+ */
+bool leaf_node_rebalance(void *parent, uint32_t separator, void *left, void *right)
+{
+	uint32_t left_used = LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(left);
+	uint32_t right_used = LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(right);
+
+	if (left_used + right_used <= LEAF_NODE_SPACE_FOR_CELLS)
+	{
+		for (uint32_t i = 0; i < *leaf_node_num_cells(right); i++)
+		{
+			leaf_node_insert_cell(left, *leaf_node_num_cells(left), leaf_node_key(right, i), leaf_node_value(right, i), *leaf_node_record_size(right, i));
+		}
+		*leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+		internal_node_drop_key(parent, separator);
+		return true;
+	}
+
+	uint32_t slot_size = leaf_node_slot_size(left);
+	while (true)
+	{
+		if (left_used < right_used)
+		{
+			uint32_t cost = slot_size + *leaf_node_record_size(right, 0);
+			if (left_used + 2 * cost > right_used)
+			{
+				break;
+			}
+			leaf_node_insert_cell(left, *leaf_node_num_cells(left), leaf_node_key(right, 0), leaf_node_value(right, 0), *leaf_node_record_size(right, 0));
+			leaf_node_remove_cell(right, 0);
+			left_used += cost;
+			right_used -= cost;
+		}
+		else
+		{
+			uint32_t last = *leaf_node_num_cells(left) - 1;
+			uint32_t cost = slot_size + *leaf_node_record_size(left, last);
+			if (right_used + 2 * cost > left_used)
+			{
+				break;
+			}
+			leaf_node_insert_cell(right, 0, leaf_node_key(left, last), leaf_node_value(left, last), *leaf_node_record_size(left, last));
+			leaf_node_remove_cell(left, last);
+			left_used -= cost;
+			right_used += cost;
+		}
+	}
+
+	set_internal_node_key(parent, separator, leaf_node_key(left, *leaf_node_num_cells(left) - 1));
+	return false;
+}
+
+/**
+ * Same as leaf_node_rebalance for two internal nodes. The key that
+ * separates them in the parent moves down between their children
+ * on a merge, and children rotate through it otherwise.
+ */
+bool internal_node_rebalance(Pager *pager, void *parent, uint32_t separator, uint32_t left_page_num, void *left, uint32_t right_page_num, void *right)
+{
+	uint32_t left_keys = *internal_node_num_keys(left);
+	uint32_t right_keys = *internal_node_num_keys(right);
+	uint32_t cell_size = internal_node_cell_size(left);
+	Key separator_key = internal_node_key(parent, separator);
+
+	if (left_keys + 1 + right_keys <= internal_node_max_keys(left))
+	{
+		*internal_node_cell(left, left_keys) = *internal_node_right_child(left);
+		set_internal_node_key(left, left_keys, separator_key);
+		memcpy(internal_node_cell(left, left_keys + 1), internal_node_cell(right, 0), right_keys * cell_size);
+		*internal_node_right_child(left) = *internal_node_right_child(right);
+		*internal_node_num_keys(left) = left_keys + 1 + right_keys;
+
+		for (uint32_t i = left_keys + 1; i <= left_keys + 1 + right_keys; i++)
+		{
+			update_node_parent(pager, *internal_node_child(left, i), left_page_num);
+		}
+
+		internal_node_drop_key(parent, separator);
+		return true;
+	}
+
+	while (left_keys + 1 < right_keys)
+	{
+		// First child of the right node becomes the right child of the left node
+		*internal_node_cell(left, left_keys) = *internal_node_right_child(left);
+		set_internal_node_key(left, left_keys, separator_key);
+		*internal_node_right_child(left) = *internal_node_cell(right, 0);
+		separator_key = internal_node_key(right, 0);
+		update_node_parent(pager, *internal_node_right_child(left), left_page_num);
+
+		memmove(internal_node_cell(right, 0), internal_node_cell(right, 1), (right_keys - 1) * cell_size);
+		left_keys += 1;
+		right_keys -= 1;
+	}
+	while (right_keys + 1 < left_keys)
+	{
+		// Right child of the left node becomes the first child of the right node
+		memmove(internal_node_cell(right, 1), internal_node_cell(right, 0), right_keys * cell_size);
+		*internal_node_cell(right, 0) = *internal_node_right_child(left);
+		set_internal_node_key(right, 0, separator_key);
+		update_node_parent(pager, *internal_node_cell(right, 0), right_page_num);
+
+		*internal_node_right_child(left) = *internal_node_cell(left, left_keys - 1);
+		separator_key = internal_node_key(left, left_keys - 1);
+		left_keys -= 1;
+		right_keys += 1;
+	}
+
+	*internal_node_num_keys(left) = left_keys;
+	*internal_node_num_keys(right) = right_keys;
+	set_internal_node_key(parent, separator, separator_key);
+	return false;
+}
+
+/**
+ * The root is an internal node with a single child left. Move the
+ * child into the root page, so the root stays where the header
+ * says it is and the tree gets one level shallower.
+ */
+void table_collapse_root(Table *table)
+{
+	Pager *pager = table->pager;
+	void *root = get_page(pager, table->root_page_num);
+	uint32_t child_page_num = *internal_node_right_child(root);
+	void *child = get_page(pager, child_page_num);
+
+	memcpy(root, child, PAGE_SIZE);
+	set_node_root(root, true);
+
+	if (get_node_type(root) == NODE_INTERNAL)
+	{
+		for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++)
+		{
+			update_node_parent(pager, *internal_node_child(root, i), table->root_page_num);
+		}
+	}
+
+	mark_page_dirty(pager, table->root_page_num);
+	unpin_page(pager, child_page_num);
+	unpin_page(pager, table->root_page_num);
+	pager_free_page(pager, child_page_num);
+}
+
+/**
+ * Called after something was removed from a node. A node that fell
+ * below its minimum fill is rebalanced with a sibling, its left one
+ * unless it is the first child. A merge frees the right node of the
+ * pair and takes a key from the parent, so the parent is checked
+ * next, up to the root.
+ */
+void node_rebalance(Table *table, uint32_t page_num)
+{
+	Pager *pager = table->pager;
+	void *node = get_page(pager, page_num);
+	NodeType type = get_node_type(node);
+
+	if (is_node_root(node))
+	{
+		bool collapse = type == NODE_INTERNAL && *internal_node_num_keys(node) == 0;
+		unpin_page(pager, page_num);
+		if (collapse)
+		{
+			table_collapse_root(table);
+		}
+		return;
+	}
+
+	bool underflow = type == NODE_LEAF ? LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(node) < LEAF_NODE_MIN_FILL
+									   : *internal_node_num_keys(node) < internal_node_min_keys(node);
+	uint32_t parent_page_num = *node_parent(node);
+	unpin_page(pager, page_num);
+
+	if (!underflow)
+	{
+		return;
+	}
+
+	void *parent = get_page(pager, parent_page_num);
+	uint32_t index = internal_node_child_index(parent, page_num);
+	uint32_t separator = index > 0 ? index - 1 : 0;
+	uint32_t left_page_num = *internal_node_child(parent, separator);
+	uint32_t right_page_num = *internal_node_child(parent, separator + 1);
+	void *left = get_page(pager, left_page_num);
+	void *right = get_page(pager, right_page_num);
+
+	bool merged = type == NODE_LEAF ? leaf_node_rebalance(parent, separator, left, right)
+									: internal_node_rebalance(pager, parent, separator, left_page_num, left, right_page_num, right);
+
+	mark_page_dirty(pager, left_page_num);
+	mark_page_dirty(pager, right_page_num);
+	mark_page_dirty(pager, parent_page_num);
+	unpin_page(pager, right_page_num);
+	unpin_page(pager, left_page_num);
+	unpin_page(pager, parent_page_num);
+
+	if (merged)
+	{
+		pager_free_page(pager, right_page_num);
+		node_rebalance(table, parent_page_num);
+	}
+}
+
+/**
+ * Delete the cell under the cursor and its overflow pages
+ */
+void leaf_node_delete(Cursor *cursor)
+{
+	Pager *pager = cursor->table->pager;
+	void *node = get_page(pager, cursor->page_num);
+
+	freeRowOverflow(cursor->table, leaf_node_value(node, cursor->cell_num));
+	leaf_node_remove_cell(node, cursor->cell_num);
+
+	mark_page_dirty(pager, cursor->page_num);
+	unpin_page(pager, cursor->page_num);
+
+	node_rebalance(cursor->table, cursor->page_num);
+}
+
+/**
+ * The row under the cursor, with the columns set in columns or all
+ * of them if it is NULL, as deserializeRow reads them
+ */
+void cursorRow(Cursor *cursor, Row *row, const vector<bool> *columns)
+{
+	uint32_t page_num = cursor->page_num;
+	void *page = get_page(cursor->table->pager, page_num);
+
+	row->id = (uint32_t)leaf_node_key(page, cursor->cell_num);
+	deserializeRow(cursor->table, leaf_node_value(page, cursor->cell_num), row, columns);
+
+	unpin_page(cursor->table->pager, page_num);
+}
+
+void cursorAdvance(Cursor *cursor)
+{
+	uint32_t page_num = cursor->page_num;
+	void *node = get_page(cursor->table->pager, page_num);
+
+	cursor->cell_num += 1;
+
+	if (cursor->cell_num >= (*leaf_node_num_cells(node)))
+	{
+		// Advance to next leaf node
+		uint32_t next_page_num = *leaf_node_next_leaf(node);
+		if (next_page_num == 0)
+		{
+			// This was the rightmost leaf
+			cursor->endOfTable = true;
+		}
+		else
+		{
+			cursor->page_num = next_page_num;
+			cursor->cell_num = 0;
+		}
+	}
+
+	unpin_page(cursor->table->pager, page_num);
+}
+
+/**
+ * Return a cursor at the first key >= key, descending from the root.
+ * table_find may land one past the last cell of a leaf, in which
+ * case the cursor moves on to the start of the next leaf.
+ */
+Cursor *tableSeek(Table *table, Key key)
+{
+	Cursor *cursor = table_find(table, key);
+
+	void *node = get_page(table->pager, cursor->page_num);
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	unpin_page(table->pager, cursor->page_num);
+
+	if (num_cells == 0)
+	{
+		cursor->endOfTable = true;
+	}
+	else if (cursor->cell_num >= num_cells)
+	{
+		cursor->cell_num = num_cells - 1;
+		cursorAdvance(cursor);
+	}
+
+	return cursor;
+}
+
+Cursor *tableStart(Table *table) { return tableSeek(table, 0); }
+
+Key cursorKey(Cursor *cursor)
+{
+	void *node = get_page(cursor->table->pager, cursor->page_num);
+	Key key = leaf_node_key(node, cursor->cell_num);
+	unpin_page(cursor->table->pager, cursor->page_num);
+
+	return key;
+}
+
+string trim(const string &text)
+{
+	size_t start = text.find_first_not_of(" \t");
+	if (start == string::npos)
+	{
+		return "";
+	}
+	return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+bool isWordChar(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+void lexerSkipSpace(Lexer *lexer)
+{
+	while (lexer->position < lexer->input.length() && isSpace(lexer->input[lexer->position]))
+	{
+		lexer->position += 1;
+	}
+}
+
+Token lexerToken(Lexer *lexer, TokenType_t type, size_t start, size_t end)
+{
+	lexer->position = end;
+	Token token;
+	token.type = type;
+	token.text = lexer->input.substr(start, end - start);
+	return token;
+}
+
+Token lexerString(Lexer *lexer)
+{
+	size_t start = lexer->position + 1;
+	size_t end = start;
+	while (true)
+	{
+		end = lexer->input.find('\'', end);
+		if (end == string_view::npos)
+		{
+			return lexerToken(lexer, TOKEN_INVALID, start, lexer->input.length());
+		}
+		if (end + 1 < lexer->input.length() && lexer->input[end + 1] == '\'')
+		{
+			end += 2;
+			continue;
+		}
+		Token token = lexerToken(lexer, TOKEN_STRING, start, end);
+		lexer->position = end + 1;
+		return token;
+	}
+}
+
+/**
+ * Next token of the statement structure: a word, a quoted string
+ * or a symbol
+ */
+Token lexerNext(Lexer *lexer)
+{
+	lexerSkipSpace(lexer);
+	string_view input = lexer->input;
+	size_t start = lexer->position;
+
+	if (start == input.length())
+	{
+		return lexerToken(lexer, TOKEN_END, start, start);
+	}
+
+	char c = input[start];
+	if (c == '\'')
+	{
+		return lexerString(lexer);
+	}
+	if (isWordChar(c))
+	{
+		size_t end = start + 1;
+		while (end < input.length() && isWordChar(input[end]))
+		{
+			end += 1;
+		}
+		return lexerToken(lexer, TOKEN_WORD, start, end);
+	}
+
+	string_view pair = input.substr(start, 2);
+	if (pair == "<=" || pair == ">=" || pair == "!=" || pair == "<>")
+	{
+		return lexerToken(lexer, TOKEN_SYMBOL, start, start + 2);
+	}
+	return lexerToken(lexer, TOKEN_SYMBOL, start, start + 1);
+}
+
+Token lexerPeek(Lexer *lexer)
+{
+	Lexer copy = *lexer;
+	return lexerNext(&copy);
+}
+
+/**
+ * Next value: a quoted string, a ? placeholder or, so values need
+ * no quotes when they have no spaces in them, everything up to the
+ * next space, comma or parenthesis
+ */
+Token lexerValue(Lexer *lexer)
+{
+	lexerSkipSpace(lexer);
+	string_view input = lexer->input;
+	size_t start = lexer->position;
+
+	if (start < input.length() && input[start] == '\'')
+	{
+		return lexerString(lexer);
+	}
+	if (start < input.length() && input[start] == '?')
+	{
+		return lexerToken(lexer, TOKEN_SYMBOL, start, start + 1);
+	}
+
+	size_t end = start;
+	while (end < input.length() && !isSpace(input[end]) && input[end] != ',' && input[end] != '(' && input[end] != ')')
+	{
+		end += 1;
+	}
+	return lexerToken(lexer, end > start ? TOKEN_WORD : TOKEN_INVALID, start, end);
+}
+
+/**
+ * Keywords are not case sensitive
+ */
+bool tokenIs(Token token, const char *text)
+{
+	size_t length = strlen(text);
+	if ((token.type != TOKEN_WORD && token.type != TOKEN_SYMBOL) || token.text.length() != length)
+	{
+		return false;
+	}
+	return strncasecmp(token.text.data(), text, length) == 0;
+}
+
+bool isValue(Token token) { return token.type == TOKEN_WORD || token.type == TOKEN_STRING || tokenIs(token, "?"); }
+
+bool parseName(Lexer *lexer, string_view *name)
+{
+	Token token = lexerNext(lexer);
+	*name = token.text;
+	return token.type == TOKEN_WORD;
+}
+
+/**
+ * where <condition> [and <condition> ...]
+ * condition: <column> <op> <value> | <column> between <value> and <value>
+ *          | <column> like <pattern>
+ */
+PrepareResult_t parseWhere(Lexer *lexer, AstStatement *ast)
+{
+	if (!tokenIs(lexerPeek(lexer), "where"))
+	{
+		return PREPARE_SUCCESS;
+	}
+	lexerNext(lexer);
+
+	while (true)
+	{
+		AstCondition condition;
+		if (!parseName(lexer, &(condition.column)))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		Token op = lexerNext(lexer);
+		if (tokenIs(op, "="))
+		{
+			condition.op = COMPARE_EQ;
+		}
+		else if (tokenIs(op, "!=") || tokenIs(op, "<>"))
+		{
+			condition.op = COMPARE_NE;
+		}
+		else if (tokenIs(op, "<"))
+		{
+			condition.op = COMPARE_LT;
+		}
+		else if (tokenIs(op, "<="))
+		{
+			condition.op = COMPARE_LE;
+		}
+		else if (tokenIs(op, ">"))
+		{
+			condition.op = COMPARE_GT;
+		}
+		else if (tokenIs(op, ">="))
+		{
+			condition.op = COMPARE_GE;
+		}
+		else if (tokenIs(op, "between"))
+		{
+			condition.op = COMPARE_BETWEEN;
+		}
+		else if (tokenIs(op, "like"))
+		{
+			condition.op = COMPARE_LIKE;
+		}
+		else
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		condition.value = lexerValue(lexer);
+		if (condition.op == COMPARE_BETWEEN)
+		{
+			if (!tokenIs(lexerNext(lexer), "and"))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			condition.high = lexerValue(lexer);
+			if (!isValue(condition.high))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+		}
+		if (!isValue(condition.value))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		ast->where.push_back(condition);
+
+		if (!tokenIs(lexerPeek(lexer), "and"))
+		{
+			break;
+		}
+		lexerNext(lexer);
+	}
+
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Comma separated names up to a closing parenthesis, which is consumed
+ */
+PrepareResult_t parseColumnList(Lexer *lexer, vector<string_view> *columns)
+{
+	while (true)
+	{
+		string_view column;
+		if (!parseName(lexer, &column))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		columns->push_back(column);
+
+		Token token = lexerNext(lexer);
+		if (tokenIs(token, ")"))
+		{
+			return PREPARE_SUCCESS;
+		}
+		if (!tokenIs(token, ","))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+	}
+}
+
+/**
+ * insert <value> ...
+ * insert [into <table>] [(<column>, ...)] values (<value>, ...), ...
+ */
+PrepareResult_t parseInsert(Lexer *lexer, AstStatement *ast)
+{
+	ast->type = STATEMENT_INSERT;
+
+	Token token = lexerPeek(lexer);
+	if (!tokenIs(token, "into") && !tokenIs(token, "(") && !tokenIs(token, "values"))
+	{
+		while (token.type != TOKEN_END && !tokenIs(token, ";"))
+		{
+			ast->values.push_back(lexerValue(lexer));
+			if (!isValue(ast->values.back()))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			token = lexerPeek(lexer);
+		}
+		ast->valuesPerRow = ast->values.size();
+		return PREPARE_SUCCESS;
+	}
+
+	if (tokenIs(token, "into"))
+	{
+		lexerNext(lexer);
+		if (!parseName(lexer, &(ast->table)))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+	}
+
+	if (tokenIs(lexerPeek(lexer), "("))
+	{
+		lexerNext(lexer);
+		PrepareResult_t result = parseColumnList(lexer, &(ast->columns));
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+
+	if (!tokenIs(lexerNext(lexer), "values"))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	ast->valuesPerRow = 0;
+	while (true)
+	{
+		if (!tokenIs(lexerNext(lexer), "("))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		uint32_t count = 0;
+		while (true)
+		{
+			ast->values.push_back(lexerValue(lexer));
+			if (!isValue(ast->values.back()))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			count += 1;
+
+			token = lexerNext(lexer);
+			if (tokenIs(token, ")"))
+			{
+				break;
+			}
+			if (!tokenIs(token, ","))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+		}
+
+		if (ast->valuesPerRow != 0 && count != ast->valuesPerRow)
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		ast->valuesPerRow = count;
+
+		if (!tokenIs(lexerPeek(lexer), ","))
+		{
+			break;
+		}
+		lexerNext(lexer);
+	}
+
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * select [* | <column>, ...] [from <table>] [where ...]
+ */
+PrepareResult_t parseSelect(Lexer *lexer, AstStatement *ast)
+{
+	ast->type = STATEMENT_SELECT;
+
+	Token token = lexerPeek(lexer);
+	if (tokenIs(token, "*"))
+	{
+		lexerNext(lexer);
+	}
+	else if (token.type == TOKEN_WORD && !tokenIs(token, "from") && !tokenIs(token, "where"))
+	{
+		while (true)
+		{
+			string_view column;
+			if (!parseName(lexer, &column))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			ast->columns.push_back(column);
+
+			if (!tokenIs(lexerPeek(lexer), ","))
+			{
+				break;
+			}
+			lexerNext(lexer);
+		}
+	}
+
+	if (tokenIs(lexerPeek(lexer), "from"))
+	{
+		lexerNext(lexer);
+		if (!parseName(lexer, &(ast->table)))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+	}
+
+	return parseWhere(lexer, ast);
+}
+
+/**
+ * delete [from <table>] [where ...]
+ */
+PrepareResult_t parseDelete(Lexer *lexer, AstStatement *ast)
+{
+	ast->type = STATEMENT_DELETE;
+
+	if (tokenIs(lexerPeek(lexer), "from"))
+	{
+		lexerNext(lexer);
+		if (!parseName(lexer, &(ast->table)))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+	}
+
+	return parseWhere(lexer, ast);
+}
+
+/**
+ * update [<table>] set <column> = <value>, ... [where ...]
+ */
+PrepareResult_t parseUpdate(Lexer *lexer, AstStatement *ast)
+{
+	ast->type = STATEMENT_UPDATE;
+
+	if (!tokenIs(lexerPeek(lexer), "set") && !parseName(lexer, &(ast->table)))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+	if (!tokenIs(lexerNext(lexer), "set"))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	while (true)
+	{
+		string_view column;
+		if (!parseName(lexer, &column) || !tokenIs(lexerNext(lexer), "="))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		Token value = lexerValue(lexer);
+		if (!isValue(value))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		ast->assignments.push_back(make_pair(column, value));
+
+		if (!tokenIs(lexerPeek(lexer), ","))
+		{
+			break;
+		}
+		lexerNext(lexer);
+	}
+
+	return parseWhere(lexer, ast);
+}
+
+/**
+ * create table <name> (<column> <type>, ...)
+ * type: integer | real | text [(<length>)] | blob [(<length>)]
+ */
+PrepareResult_t parseCreateTable(Lexer *lexer, AstStatement *ast)
+{
+	ast->type = STATEMENT_CREATE_TABLE;
+
+	if (!parseName(lexer, &(ast->table)) || !tokenIs(lexerNext(lexer), "("))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	while (true)
+	{
+		AstColumn definition;
+		if (!parseName(lexer, &(definition.name)))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		definition.type = lexerNext(lexer);
+		if (definition.type.type != TOKEN_WORD)
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		definition.length.type = TOKEN_END;
+		if (tokenIs(lexerPeek(lexer), "("))
+		{
+			lexerNext(lexer);
+			definition.length = lexerNext(lexer);
+			if (definition.length.type != TOKEN_WORD || !tokenIs(lexerNext(lexer), ")"))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+		}
+		ast->definitions.push_back(definition);
+
+		Token token = lexerNext(lexer);
+		if (tokenIs(token, ")"))
+		{
+			return PREPARE_SUCCESS;
+		}
+		if (!tokenIs(token, ","))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+	}
+}
+
+/**
+ * create index [<name>] on <table> (<column>) [include (<column>, ...)]
+ */
+PrepareResult_t parseCreateIndex(Lexer *lexer, AstStatement *ast)
+{
+	ast->type = STATEMENT_CREATE_INDEX;
+
+	if (!tokenIs(lexerPeek(lexer), "on") && !parseName(lexer, &(ast->index)))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+	if (!tokenIs(lexerNext(lexer), "on") || !parseName(lexer, &(ast->table)) || !tokenIs(lexerNext(lexer), "("))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	string_view column;
+	if (!parseName(lexer, &column) || !tokenIs(lexerNext(lexer), ")"))
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+	ast->columns.push_back(column);
+
+	if (tokenIs(lexerPeek(lexer), "include"))
+	{
+		lexerNext(lexer);
+		if (!tokenIs(lexerNext(lexer), "("))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		return parseColumnList(lexer, &(ast->columns));
+	}
+	return PREPARE_SUCCESS;
+}
+
+PrepareResult_t parseCreate(Lexer *lexer, AstStatement *ast)
+{
+	Token token = lexerNext(lexer);
+	if (tokenIs(token, "table"))
+	{
+		return parseCreateTable(lexer, ast);
+	}
+	if (tokenIs(token, "index"))
+	{
+		return parseCreateIndex(lexer, ast);
+	}
+	return PREPARE_SYNTAX_ERROR;
+}
+
+/**
+ * Recursive descent over the statement text, one function per
+ * statement and clause
+ */
+PrepareResult_t parseStatement(string_view input, AstStatement *ast)
+{
+	Lexer lexer;
+	lexer.input = input;
+	lexer.position = 0;
+
+	Token keyword = lexerNext(&lexer);
+	PrepareResult_t result;
+	if (tokenIs(keyword, "insert"))
+	{
+		result = parseInsert(&lexer, ast);
+	}
+	else if (tokenIs(keyword, "select"))
+	{
+		result = parseSelect(&lexer, ast);
+	}
+	else if (tokenIs(keyword, "delete"))
+	{
+		result = parseDelete(&lexer, ast);
+	}
+	else if (tokenIs(keyword, "update"))
+	{
+		result = parseUpdate(&lexer, ast);
+	}
+	else if (tokenIs(keyword, "create"))
+	{
+		result = parseCreate(&lexer, ast);
+	}
+	else
+	{
+		return PREPARE_UNRECOGNIZED_STATEMENT;
+	}
+
+	if (result != PREPARE_SUCCESS)
+	{
+		return result;
+	}
+
+	Token token = lexerNext(&lexer);
+	if (tokenIs(token, ";"))
+	{
+		token = lexerNext(&lexer);
+	}
+	return token.type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+PrepareResult_t parseKey(string_view text, uint32_t *key)
+{
+	bool negative = !text.empty() && text[0] == '-';
+	size_t start = negative ? 1 : 0;
+	if (start == text.length())
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	uint64_t value = 0;
+	for (size_t i = start; i < text.length(); i++)
+	{
+		if (!isdigit((unsigned char)text[i]))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		value = value * 10 + (text[i] - '0');
+		if (value > UINT32_MAX)
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+	}
+
+	if (negative && value > 0)
+	{
+		return PREPARE_NEGATIVE_ID;
+	}
+
+	*key = (uint32_t)value;
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Text of a value token, with the doubled quotes of a quoted string
+ * turned back into single ones
+ */
+string tokenText(Token token)
+{
+	if (token.type != TOKEN_STRING || token.text.find('\'') == string_view::npos)
+	{
+		return string(token.text);
+	}
+
+	string text;
+	for (size_t i = 0; i < token.text.length(); i++)
+	{
+		text += token.text[i];
+		if (token.text[i] == '\'')
+		{
+			i += 1;
+		}
+	}
+	return text;
+}
+
+/**
+ * Table and column names are not case sensitive
+ */
+bool sameName(string_view name, string_view other)
+{
+	return name.length() == other.length() && strncasecmp(name.data(), other.data(), name.length()) == 0;
+}
+
+/**
+ * The table called name, or NULL if there is none
+ */
+Table *findTable(Database *db, string_view name)
+{
+	if (sameName(name, db->schema->name))
+	{
+		return db->schema;
+	}
+	for (uint32_t i = 0; i < db->tables.size(); i++)
+	{
+		if (sameName(name, db->tables[i]->name))
+		{
+			return db->tables[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * The index called name, or NULL if there is none
+ */
+Index *findIndex(Database *db, string_view name)
+{
+	for (uint32_t i = 0; i < db->indexes.size(); i++)
+	{
+		if (sameName(name, db->indexes[i]->name))
+		{
+			return db->indexes[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Index of a column of table, or -1 if there is no such column
+ */
+int columnIndex(Table *table, string_view name)
+{
+	for (uint32_t i = 0; i < table->columns.size(); i++)
+	{
+		if (sameName(name, table->columns[i].name))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+string *rowText(Row *row, uint32_t column) { return &(row->values[column - 1]); }
+
+int hexDigit(char c)
+{
+	if (isdigit((unsigned char)c))
+	{
+		return c - '0';
+	}
+	c = tolower((unsigned char)c);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/**
+ * Check a value for any column but the key and convert it to the
+ * form rows hold it in: numbers as their shortest text, a BLOB
+ * written as x'<hex digits>' as its bytes and everything else as
+ * it is
+ */
+PrepareResult_t parseValue(Column *column, string_view text, string *value)
+{
+	const char *end = text.data() + text.length();
+
+	switch (column->type)
+	{
+	case (COLUMN_INTEGER):
+	{
+		int64_t number;
+		from_chars_result result = from_chars(text.data(), end, number);
+		if (text.empty() || result.ec != errc() || result.ptr != end)
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		*value = to_string(number);
+		return PREPARE_SUCCESS;
+	}
+	case (COLUMN_REAL):
+	{
+		double number;
+		from_chars_result result = from_chars(text.data(), end, number);
+		if (text.empty() || result.ec != errc() || result.ptr != end || !isfinite(number))
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		*value = formatReal(number);
+		return PREPARE_SUCCESS;
+	}
+	case (COLUMN_BLOB):
+		if (text.length() >= 3 && tolower((unsigned char)text[0]) == 'x' && text[1] == '\'' && text.back() == '\'')
+		{
+			string_view digits = text.substr(2, text.length() - 3);
+			if (digits.length() % 2 != 0)
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			value->clear();
+			for (size_t i = 0; i < digits.length(); i += 2)
+			{
+				int high = hexDigit(digits[i]);
+				int low = hexDigit(digits[i + 1]);
+				if (high < 0 || low < 0)
+				{
+					return PREPARE_SYNTAX_ERROR;
+				}
+				*value += (char)(high << 4 | low);
+			}
+			break;
+		}
+		value->assign(text.data(), text.length());
+		break;
+	default:
+		value->assign(text.data(), text.length());
+		break;
+	}
+
+	if (value->length() > column->maxLength)
+	{
+		return PREPARE_STRING_TOO_LONG;
+	}
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Convert a value token for column, the id is a key and the others
+ * go through parseValue. A ? only records where its value goes
+ * once it is bound.
+ */
+PrepareResult_t planValue(Statement *statement, Token token, uint32_t column, uint32_t *key, string *text)
+{
+	if (tokenIs(token, "?"))
+	{
+		Parameter parameter;
+		parameter.column = column;
+		parameter.pattern = false;
+		parameter.key = key;
+		parameter.text = text;
+		statement->parameters.push_back(parameter);
+		return PREPARE_SUCCESS;
+	}
+
+	if (column == 0)
+	{
+		return token.type == TOKEN_WORD ? parseKey(token.text, key) : PREPARE_SYNTAX_ERROR;
+	}
+
+	return parseValue(&(statement->table->columns[column]), tokenText(token), text);
+}
+
+/**
+ * A like pattern is taken as it is, it may well be longer than the
+ * values it matches
+ */
+PrepareResult_t planPattern(Statement *statement, Token token, uint32_t column, string *pattern)
+{
+	if (tokenIs(token, "?"))
+	{
+		Parameter parameter;
+		parameter.column = column;
+		parameter.pattern = true;
+		parameter.key = NULL;
+		parameter.text = pattern;
+		statement->parameters.push_back(parameter);
+		return PREPARE_SUCCESS;
+	}
+
+	*pattern = tokenText(token);
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Columns a scan reads from each row: those the filters check, and
+ * for a select those it returns. The id is the key, it is always
+ * there.
+ */
+void planColumns(Statement *statement)
+{
+	uint32_t num_columns = statement->table->columns.size();
+
+	statement->filterColumns.assign(num_columns, false);
+	for (uint32_t i = 0; i < statement->filters.size(); i++)
+	{
+		statement->filterColumns[statement->filters[i].column] = true;
+	}
+
+	statement->returnColumns.assign(num_columns, false);
+	if (statement->type == STATEMENT_SELECT)
+	{
+		for (uint32_t i = 1; i < num_columns; i++)
+		{
+			bool returned = statement->columns.empty() || find(statement->columns.begin(), statement->columns.end(), i) != statement->columns.end();
+			statement->returnColumns[i] = returned && !statement->filterColumns[i];
+		}
+	}
+}
+
+/**
+ * Whether the entries of index hold every column a statement reads
+ */
+bool indexCovers(Index *index, Statement *statement)
+{
+	for (uint32_t i = 1; i < statement->table->columns.size(); i++)
+	{
+		bool read = statement->filterColumns[i] || statement->returnColumns[i];
+		if (read && find(index->columns.begin(), index->columns.end(), i) == index->columns.end())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Pick an index to look rows up in. It needs a filter that compares
+ * its column for equality or with like, equality being preferred.
+ * An id that must be equal to a value already narrows the rows down
+ * to one, so no index is used then.
+ */
+void planIndex(Statement *statement)
+{
+	statement->index = NULL;
+	statement->indexOnly = false;
+
+	for (uint32_t i = 0; i < statement->keyFilters.size(); i++)
+	{
+		if (statement->keyFilters[i].op == COMPARE_EQ)
+		{
+			return;
+		}
+	}
+
+	for (uint32_t i = 0; i < statement->filters.size(); i++)
+	{
+		Filter *filter = &(statement->filters[i]);
+		if (filter->op != COMPARE_EQ && filter->op != COMPARE_LIKE)
+		{
+			continue;
+		}
+		if (statement->index != NULL && (filter->op == COMPARE_LIKE || statement->filters[statement->indexFilter].op == COMPARE_EQ))
+		{
+			continue;
+		}
+
+		for (uint32_t j = 0; j < statement->table->indexes.size(); j++)
+		{
+			if (statement->table->indexes[j]->columns[0] == filter->column)
+			{
+				statement->index = statement->table->indexes[j];
+				statement->indexFilter = i;
+				break;
+			}
+		}
+	}
+
+	if (statement->index != NULL)
+	{
+		statement->indexOnly = indexCovers(statement->index, statement);
+	}
+}
+
+/**
+ * Sort the where clause into conditions on the id, which make up
+ * the key range, and filters for everything the range can't express
+ */
+PrepareResult_t planWhere(AstStatement *ast, Statement *statement)
+{
+	statement->keyFilters.clear();
+	statement->filters.clear();
+	statement->keyFilters.reserve(ast->where.size());
+	statement->filters.reserve(ast->where.size());
+
+	for (uint32_t i = 0; i < ast->where.size(); i++)
+	{
+		AstCondition *condition = &(ast->where[i]);
+		int column = columnIndex(statement->table, condition->column);
+		if (column < 0)
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		vector<Filter> *filters = column == 0 && condition->op != COMPARE_NE ? &(statement->keyFilters) : &(statement->filters);
+		filters->push_back(Filter());
+		Filter *filter = &(filters->back());
+		filter->column = column;
+		filter->op = condition->op;
+
+		PrepareResult_t result;
+		if (condition->op == COMPARE_LIKE)
+		{
+			// Only TEXT columns, which leaves out the id
+			if (statement->table->columns[column].type != COLUMN_TEXT)
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			result = planPattern(statement, condition->value, column, &(filter->value));
+		}
+		else
+		{
+			result = planValue(statement, condition->value, column, &(filter->key), &(filter->value));
+		}
+		if (result == PREPARE_SUCCESS && condition->op == COMPARE_BETWEEN)
+		{
+			result = planValue(statement, condition->high, column, &(filter->highKey), &(filter->high));
+		}
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+
+	planColumns(statement);
+	planIndex(statement);
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Intersect the conditions on the id into the key range. Done when
+ * the statement runs, since they may have parameters.
+ */
+void resolveKeyRange(Statement *statement)
+{
+	statement->startKey = 0;
+	statement->endKey = UINT32_MAX;
+
+	for (uint32_t i = 0; i < statement->keyFilters.size(); i++)
+	{
+		Filter *filter = &(statement->keyFilters[i]);
+		uint32_t low = 0;
+		uint32_t high = UINT32_MAX;
+		switch (filter->op)
+		{
+		case (COMPARE_EQ):
+			low = high = filter->key;
+			break;
+		case (COMPARE_LT):
+			if (filter->key == 0)
+			{
+				low = 1;
+				high = 0;
+			}
+			else
+			{
+				high = filter->key - 1;
+			}
+			break;
+		case (COMPARE_LE):
+			high = filter->key;
+			break;
+		case (COMPARE_GT):
+			if (filter->key == UINT32_MAX)
+			{
+				low = 1;
+				high = 0;
+			}
+			else
+			{
+				low = filter->key + 1;
+			}
+			break;
+		case (COMPARE_GE):
+			low = filter->key;
+			break;
+		default:
+			low = filter->key;
+			high = filter->highKey;
+			break;
+		}
+		statement->startKey = max(statement->startKey, low);
+		statement->endKey = min(statement->endKey, high);
+	}
+}
+
+/**
+ * Range of index keys that hold the value of the index filter, or
+ * for a like pattern every value that starts with the text before
+ * its first wildcard. Keys only hold the start of values, so the
+ * range can be wider than the filter and rows are still checked
+ * against it. Done when the statement runs, like the key range.
+ */
+void resolveIndexRange(Statement *statement)
+{
+	statement->useIndex = false;
+	if (statement->index == NULL)
+	{
+		return;
+	}
+
+	Filter *filter = &(statement->filters[statement->indexFilter]);
+	if (filter->op == COMPARE_EQ)
+	{
+		statement->indexStart = indexValueKey(&(statement->table->columns[filter->column]), filter->value);
+		statement->indexEnd = statement->indexStart | UINT32_MAX;
+		statement->useIndex = true;
+		return;
+	}
+
+	string_view prefix = string_view(filter->value).substr(0, filter->value.find_first_of("%_"));
+	if (prefix.empty())
+	{
+		return;
+	}
+	statement->indexStart = indexTextKey(prefix, 0);
+	statement->indexEnd = indexTextKey(prefix, UINT8_MAX) | UINT32_MAX;
+	statement->useIndex = true;
+}
+
+PrepareResult_t planInsert(AstStatement *ast, Statement *statement)
+{
+	uint32_t num_columns = statement->table->columns.size();
+
+	vector<uint32_t> columns;
+	for (uint32_t i = 0; i < ast->columns.size(); i++)
+	{
+		int column = columnIndex(statement->table, ast->columns[i]);
+		if (column < 0 || find(columns.begin(), columns.end(), (uint32_t)column) != columns.end())
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		columns.push_back(column);
+	}
+	if (columns.empty())
+	{
+		for (uint32_t i = 0; i < num_columns; i++)
+		{
+			columns.push_back(i);
+		}
+	}
+
+	// Every column needs a value
+	if (columns.size() != num_columns || ast->valuesPerRow != num_columns)
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	// Size all rows before parameters point into them
+	statement->rows.resize(ast->values.size() / num_columns);
+	for (uint32_t i = 0; i < statement->rows.size(); i++)
+	{
+		statement->rows[i].values.resize(num_columns - 1);
+	}
+
+	for (uint32_t i = 0; i < ast->values.size(); i++)
+	{
+		Row *row = &(statement->rows[i / num_columns]);
+		uint32_t column = columns[i % num_columns];
+		PrepareResult_t result = planValue(statement, ast->values[i], column, &(row->id), column == 0 ? NULL : rowText(row, column));
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+
+	return PREPARE_SUCCESS;
+}
+
+PrepareResult_t planUpdate(AstStatement *ast, Statement *statement)
+{
+	statement->assigned.assign(statement->table->columns.size(), false);
+	statement->row.values.resize(statement->table->columns.size() - 1);
+
+	for (uint32_t i = 0; i < ast->assignments.size(); i++)
+	{
+		int column = columnIndex(statement->table, ast->assignments[i].first);
+		// The id is the key, it can't be changed
+		if (column <= 0 || statement->assigned[column])
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		PrepareResult_t result = planValue(statement, ast->assignments[i].second, column, NULL, rowText(&(statement->row), column));
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+		statement->assigned[column] = true;
+	}
+
+	return planWhere(ast, statement);
+}
+
+/**
+ * The columns of a new table. The first one is the key, so it must
+ * be an INTEGER, and a row has to fit a leaf with room to spare.
+ */
+PrepareResult_t planCreate(AstStatement *ast, Statement *statement)
+{
+	statement->name = string(ast->table);
+	statement->definition.clear();
+
+	for (uint32_t i = 0; i < ast->definitions.size(); i++)
+	{
+		AstColumn *definition = &(ast->definitions[i]);
+		Column column;
+		column.name = string(definition->name);
+		column.maxLength = COLUMN_MAX_LENGTH;
+
+		if (tokenIs(definition->type, "integer"))
+		{
+			column.type = COLUMN_INTEGER;
+		}
+		else if (tokenIs(definition->type, "real"))
+		{
+			column.type = COLUMN_REAL;
+		}
+		else if (tokenIs(definition->type, "text"))
+		{
+			column.type = COLUMN_TEXT;
+		}
+		else if (tokenIs(definition->type, "blob"))
+		{
+			column.type = COLUMN_BLOB;
+		}
+		else
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+
+		if (definition->length.type != TOKEN_END)
+		{
+			if (column.type == COLUMN_INTEGER || column.type == COLUMN_REAL)
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			PrepareResult_t result = parseKey(definition->length.text, &(column.maxLength));
+			if (result != PREPARE_SUCCESS || column.maxLength == 0 || column.maxLength > COLUMN_MAX_LENGTH)
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+		}
+
+		for (uint32_t j = 0; j < statement->definition.size(); j++)
+		{
+			if (sameName(column.name, statement->definition[j].name))
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+		}
+		statement->definition.push_back(column);
+	}
+
+	if (statement->definition[0].type != COLUMN_INTEGER)
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+	if (recordMaxSize(statement->definition) > ROW_MAX_SIZE)
+	{
+		return PREPARE_ROW_TOO_LARGE;
+	}
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * The column a new index maps to rows, the columns it includes, and
+ * the name of the index, by default made up of the names of the
+ * table and the indexed column. The id is the key of the table and
+ * part of every index key already, so it can't be indexed or
+ * included. An entry has to fit an index leaf like a row does a
+ * table leaf.
+ */
+PrepareResult_t planCreateIndex(AstStatement *ast, Statement *statement)
+{
+	vector<Column> columns(1, statement->table->columns[0]);
+	for (uint32_t i = 0; i < ast->columns.size(); i++)
+	{
+		int column = columnIndex(statement->table, ast->columns[i]);
+		if (column <= 0 || find(statement->columns.begin(), statement->columns.end(), (uint32_t)column) != statement->columns.end())
+		{
+			return PREPARE_SYNTAX_ERROR;
+		}
+		statement->columns.push_back(column);
+		columns.push_back(statement->table->columns[column]);
+	}
+	if (recordMaxSize(columns) > INDEX_ROW_MAX_SIZE)
+	{
+		return PREPARE_ENTRY_TOO_LARGE;
+	}
+
+	if (ast->index.empty())
+	{
+		statement->name = statement->table->name + "_" + statement->table->columns[statement->columns[0]].name;
+	}
+	else
+	{
+		statement->name = string(ast->index);
+	}
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Create table statement for the table a statement creates, as the
+ * schema table keeps it
+ */
+string tableSql(Statement *statement)
+{
+	const char *type_names[] = {"integer", "real", "text", "blob"};
+
+	string sql = "create table " + statement->name + " (";
+	for (uint32_t i = 0; i < statement->definition.size(); i++)
+	{
+		Column *column = &(statement->definition[i]);
+		if (i > 0)
+		{
+			sql += ", ";
+		}
+		sql += column->name + " " + type_names[column->type];
+		if ((column->type == COLUMN_TEXT || column->type == COLUMN_BLOB) && column->maxLength != COLUMN_MAX_LENGTH)
+		{
+			sql += "(" + to_string(column->maxLength) + ")";
+		}
+	}
+	return sql + ")";
+}
+
+/**
+ * Create index statement for the index a statement creates, as the
+ * schema table keeps it
+ */
+string indexSql(Statement *statement)
+{
+	vector<Column> &columns = statement->table->columns;
+
+	string sql = "create index " + statement->name + " on " + statement->table->name + " (" + columns[statement->columns[0]].name + ")";
+	for (uint32_t i = 1; i < statement->columns.size(); i++)
+	{
+		sql += (i == 1 ? " include (" : ", ") + columns[statement->columns[i]].name;
+	}
+	return statement->columns.size() > 1 ? sql + ")" : sql;
+}
+
+/**
+ * Check the names in the statement against the schema and turn its
+ * values into rows, keys and filters
+ */
+PrepareResult_t planStatement(Database *db, AstStatement *ast, Statement *statement)
+{
+	statement->type = ast->type;
+	statement->rows.clear();
+	statement->columns.clear();
+	statement->parameters.clear();
+	statement->index = NULL;
+	statement->indexOnly = false;
+
+	if (ast->type == STATEMENT_CREATE_TABLE)
+	{
+		statement->table = NULL;
+		return planCreate(ast, statement);
+	}
+
+	statement->table = findTable(db, ast->table.empty() ? string_view(DEFAULT_TABLE_NAME) : ast->table);
+	if (statement->table == NULL)
+	{
+		return PREPARE_UNKNOWN_TABLE;
+	}
+	if (statement->table == db->schema && ast->type != STATEMENT_SELECT)
+	{
+		return PREPARE_READ_ONLY_TABLE;
+	}
+
+	switch (ast->type)
+	{
+	case (STATEMENT_INSERT):
+		return planInsert(ast, statement);
+	case (STATEMENT_UPDATE):
+		return planUpdate(ast, statement);
+	case (STATEMENT_CREATE_INDEX):
+		return planCreateIndex(ast, statement);
+	case (STATEMENT_SELECT):
+		for (uint32_t i = 0; i < ast->columns.size(); i++)
+		{
+			int column = columnIndex(statement->table, ast->columns[i]);
+			if (column < 0)
+			{
+				return PREPARE_SYNTAX_ERROR;
+			}
+			statement->columns.push_back(column);
+		}
+		return planWhere(ast, statement);
+	default:
+		return planWhere(ast, statement);
+	}
+}
+
+PrepareResult_t prepareStatement(Database *db, string_view input, Statement *statement)
+{
+	AstStatement ast;
+	PrepareResult_t result = parseStatement(input, &ast);
+	if (result != PREPARE_SUCCESS)
+	{
+		return result;
+	}
+	return planStatement(db, &ast, statement);
+}
+
+/**
+ * Order of two values of column: numbers by value, TEXT and BLOB
+ * byte by byte
+ */
+int compareValues(Column *column, const string &value, const string &other)
+{
+	if (column->type == COLUMN_INTEGER)
+	{
+		int64_t number = strtoll(value.c_str(), NULL, 10);
+		int64_t other_number = strtoll(other.c_str(), NULL, 10);
+		return number < other_number ? -1 : number > other_number;
+	}
+	if (column->type == COLUMN_REAL)
+	{
+		double number = strtod(value.c_str(), NULL);
+		double other_number = strtod(other.c_str(), NULL);
+		return number < other_number ? -1 : number > other_number;
+	}
+	return value.compare(other);
+}
+
+/**
+ * Whether text matches a like pattern, in which % stands for any
+ * run of characters and _ for any one character. Case matters, so
+ * an index can look up the values that start like the pattern.
+ */
+bool likeMatches(string_view text, string_view pattern)
+{
+	size_t t = 0;
+	size_t p = 0;
+	size_t star = string_view::npos; // Pattern position of the last %
+	size_t star_t = 0;				 // and where in text it matches up to so far
+
+	while (t < text.length())
+	{
+		if (p < pattern.length() && pattern[p] == '%')
+		{
+			star = p;
+			star_t = t;
+			p += 1;
+		}
+		else if (p < pattern.length() && (pattern[p] == '_' || pattern[p] == text[t]))
+		{
+			p += 1;
+			t += 1;
+		}
+		else if (star != string_view::npos)
+		{
+			// Let the last % take one more character
+			p = star + 1;
+			star_t += 1;
+			t = star_t;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while (p < pattern.length() && pattern[p] == '%')
+	{
+		p += 1;
+	}
+	return p == pattern.length();
+}
+
+/**
+ * Whether a row passes all filters of a statement
+ */
+bool rowMatches(Statement *statement, Row *row)
+{
+	for (uint32_t i = 0; i < statement->filters.size(); i++)
+	{
+		Filter *filter = &(statement->filters[i]);
+		if (filter->op == COMPARE_LIKE)
+		{
+			if (!likeMatches(*rowText(row, filter->column), filter->value))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		int comparison;
+		int high_comparison = 0;
+		if (filter->column == 0)
+		{
+			comparison = row->id < filter->key ? -1 : row->id > filter->key;
+			high_comparison = row->id < filter->highKey ? -1 : row->id > filter->highKey;
+		}
+		else
+		{
+			Column *column = &(statement->table->columns[filter->column]);
+			string *text = rowText(row, filter->column);
+			comparison = compareValues(column, *text, filter->value);
+			if (filter->op == COMPARE_BETWEEN)
+			{
+				high_comparison = compareValues(column, *text, filter->high);
+			}
+		}
+
+		bool match;
+		switch (filter->op)
+		{
+		case (COMPARE_EQ):
+			match = comparison == 0;
+			break;
+		case (COMPARE_NE):
+			match = comparison != 0;
+			break;
+		case (COMPARE_LT):
+			match = comparison < 0;
+			break;
+		case (COMPARE_LE):
+			match = comparison <= 0;
+			break;
+		case (COMPARE_GT):
+			match = comparison > 0;
+			break;
+		case (COMPARE_GE):
+			match = comparison >= 0;
+			break;
+		default:
+			match = comparison >= 0 && high_comparison <= 0;
+			break;
+		}
+
+		if (!match)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void printValue(Table *table, Row *row, uint32_t column)
+{
+	if (column == 0)
+	{
+		cout << row->id;
+		return;
+	}
+
+	string *value = rowText(row, column);
+	if (table->columns[column].type != COLUMN_BLOB)
+	{
+		cout << *value;
+		return;
+	}
+
+	const char *digits = "0123456789abcdef";
+	string text = "x'";
+	for (size_t i = 0; i < value->length(); i++)
+	{
+		unsigned char byte = (*value)[i];
+		text += digits[byte >> 4];
+		text += digits[byte & 0xf];
+	}
+	cout << text << "'";
+}
+
+/**
+ * Print the columns of a row, all of them if columns is empty
+ */
+void printRow(Table *table, Row *row, vector<uint32_t> &columns)
+{
+	uint32_t count = columns.empty() ? table->columns.size() : columns.size();
+
+	cout << "(";
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i > 0)
+		{
+			cout << ", ";
+		}
+		printValue(table, row, columns.empty() ? i : columns[i]);
+	}
+	cout << ")\n";
+}
+
+void indent(uint32_t level)
+{
+	for (uint32_t i = 0; i < level; i++)
+	{
+		printf("  ");
+	}
+}
+
+/**
+ * Table keys print as the id, index keys as the hex digits of their
+ * value part followed by the id
+ */
+void print_key(void *node, Key key)
+{
+	if (is_index_node(node))
+	{
+		for (int32_t i = INDEX_KEY_SIZE - 1; i >= (int32_t)(INDEX_KEY_SIZE - INDEX_KEY_VALUE_SIZE); i--)
+		{
+			printf("%02x", (uint32_t)(key >> (8 * i)) & 0xff);
+		}
+		printf(":");
+	}
+	printf("%u", (uint32_t)key);
+}
+
+void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
+{
+	void *node = get_page(pager, page_num);
+
+	switch (get_node_type(node))
+	{
+	case (NODE_LEAF):
+	{
+		uint32_t num_cells = *leaf_node_num_cells(node);
+		indent(indentation_level);
+		printf("leaf (size %d)\n", num_cells);
+		for (uint32_t i = 0; i < num_cells; i++)
+		{
+			indent(indentation_level + 1);
+			printf("- %d : ", i);
+			print_key(node, leaf_node_key(node, i));
+			printf("\n");
+		}
+		break;
+	}
+	case (NODE_INTERNAL):
+	{
+		uint32_t num_keys = *internal_node_num_keys(node);
+		indent(indentation_level);
+		printf("internal (size %d)\n", num_keys);
+		for (uint32_t i = 0; i < num_keys; i++)
+		{
+			print_tree(pager, *internal_node_child(node, i), indentation_level + 1);
+			indent(indentation_level + 1);
+			printf("- key ");
+			print_key(node, internal_node_key(node, i));
+			printf("\n");
+		}
+		print_tree(pager, *internal_node_right_child(node), indentation_level + 1);
+		break;
+	}
+	}
+
+	unpin_page(pager, page_num);
+}
+
+void print_stats(Pager *pager)
+{
+	uint32_t frames_in_use = pager->numFrames - pager->freeFrames.size();
+
+	DbHeader *header = (DbHeader *)get_page(pager, DB_HEADER_PAGE_NUM);
+
+	printf("mode: %s\n", pager->mode == PAGER_MMAP ? "mmap" : "buffered");
+	printf("pages: %d\n", pager->numPages);
+	printf("free pages: %d\n", header->freePageCount);
+	unpin_page(pager, DB_HEADER_PAGE_NUM);
+	printf("mapped pages: %d\n", pager->mappedPages);
+	printf("pool frames: %d/%d\n", frames_in_use, pager->numFrames);
+	printf("pages read: %llu\n", (unsigned long long)pager->pagesRead);
+	printf("pages written: %llu\n", (unsigned long long)pager->pagesWritten);
+
+	lock_guard<mutex> guard(pager->wal->lock);
+	printf("wal frames written: %llu\n", (unsigned long long)pager->wal->framesWritten);
+	printf("wal commits: %llu\n", (unsigned long long)pager->wal->commits);
+	printf("wal syncs: %llu\n", (unsigned long long)pager->wal->syncs);
+	printf("checkpoints: %llu\n", (unsigned long long)pager->wal->checkpoints);
+}
+
+void print_constants()
+{
+	printf("ROW_MAX_SIZE: %d\n", ROW_MAX_SIZE);
+	printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+	printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+	printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+	printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+	printf("INTERNAL_NODE_HEADER_SIZE: %d\n", INTERNAL_NODE_HEADER_SIZE);
+	printf("INTERNAL_NODE_CELL_SIZE: %d\n", INTERNAL_NODE_CELL_SIZE);
+	printf("INTERNAL_NODE_MAX_KEYS: %d\n", INTERNAL_NODE_MAX_KEYS);
+}
+
+bool rowIdLess(const Row &a, const Row &b) { return a.id < b.id; }
+
+bool rowPointerIdLess(const Row *a, const Row *b) { return a->id < b->id; }
+
+bool entryKeyLess(const pair<Key, Row> &a, const pair<Key, Row> &b) { return a.first < b.first; }
+
+/**
+ * Add entries to an index in key order, so consecutive entries for
+ * the same leaf share one descent
+ */
+void indexInsertEntries(Index *index, vector<pair<Key, Row>> &entries)
+{
+	sort(entries.begin(), entries.end(), entryKeyLess);
+
+	Cursor *cursor = NULL;
+	for (uint32_t i = 0; i < entries.size(); i++)
+	{
+		cursor = table_find_next(index->tree, cursor, entries[i].first);
+		leaf_node_insert(cursor, entries[i].first, &(entries[i].second));
+	}
+	delete cursor;
+}
+
+void indexInsert(Index *index, vector<Row *> &rows)
+{
+	vector<pair<Key, Row>> entries(rows.size());
+	for (uint32_t i = 0; i < rows.size(); i++)
+	{
+		entries[i].first = indexEntry(index, rows[i], &(entries[i].second));
+	}
+	indexInsertEntries(index, entries);
+}
+
+void indexDelete(Index *index, Row *row)
+{
+	Row entry;
+	Cursor *cursor = table_find(index->tree, indexEntry(index, row, &entry));
+	leaf_node_delete(cursor);
+	delete cursor;
+}
+
+/**
+ * Fill a new index with the entries of the rows its table has
+ */
+void indexBuild(Index *index)
+{
+	vector<pair<Key, Row>> entries;
+	Cursor *cursor = tableStart(index->table);
+	Row row;
+	while (!(cursor->endOfTable))
+	{
+		cursorRow(cursor, &row, NULL);
+		entries.push_back(pair<Key, Row>());
+		entries.back().first = indexEntry(index, &row, &(entries.back().second));
+		cursorAdvance(cursor);
+	}
+	delete cursor;
+
+	indexInsertEntries(index, entries);
+}
+
+/**
+ * Insert the rows of the statement in key order, so consecutive
+ * rows for the same leaf share one descent. If any key is taken,
+ * within the statement or in the table, nothing is inserted. The
+ * rows themselves stay where they are, bound parameters point into
+ * them.
+ */
+ExecuteResult executeInsert(Statement *statement, Table *table)
+{
+	vector<Row *> rows(statement->rows.size());
+	for (uint32_t i = 0; i < rows.size(); i++)
+	{
+		rows[i] = &(statement->rows[i]);
+	}
+	if (!is_sorted(rows.begin(), rows.end(), rowPointerIdLess))
+	{
+		sort(rows.begin(), rows.end(), rowPointerIdLess);
+	}
+
+	Cursor *cursor = NULL;
+	for (uint32_t i = 0; i < rows.size(); i++)
+	{
+		if (i > 0 && rows[i]->id == rows[i - 1]->id)
+		{
+			delete cursor;
+			return EXECUTE_DUPLICATE_KEY;
+		}
+
+		cursor = table_find_next(table, cursor, rows[i]->id);
+
+		void *leaf = get_page(table->pager, cursor->page_num);
+		bool duplicate = cursor->cell_num < *leaf_node_num_cells(leaf) && leaf_node_key(leaf, cursor->cell_num) == rows[i]->id;
+		unpin_page(table->pager, cursor->page_num);
+
+		if (duplicate)
+		{
+			delete cursor;
+			return EXECUTE_DUPLICATE_KEY;
+		}
+	}
+	delete cursor;
+
+	cursor = NULL;
+	for (uint32_t i = 0; i < rows.size(); i++)
+	{
+		cursor = table_find_next(table, cursor, rows[i]->id);
+		leaf_node_insert(cursor, rows[i]->id, rows[i]);
+	}
+	delete cursor;
+
+	for (uint32_t i = 0; i < table->indexes.size(); i++)
+	{
+		indexInsert(table->indexes[i], rows);
+	}
+
+	return EXECUTE_SUCCESS;
+}
+
+/**
+ * Cursor at the first row a statement may apply to, the start of
+ * its key range or of the range of index keys it looks up
+ */
+Cursor *scanStart(Statement *statement)
+{
+	if (statement->useIndex)
+	{
+		return tableSeek(statement->index->tree, statement->indexStart);
+	}
+	return tableSeek(statement->table, statement->startKey);
+}
+
+/**
+ * Read the row under a table cursor in row and check it against the
+ * filters. Only the columns the filters check are read first, the
+ * other columns the statement returns are read once the row passes,
+ * so the overflow pages of columns nobody looks at stay unread.
+ */
+bool cursorMatches(Statement *statement, Cursor *cursor, Row *row)
+{
+	cursorRow(cursor, row, &(statement->filterColumns));
+	if (!rowMatches(statement, row))
+	{
+		return false;
+	}
+	cursorRow(cursor, row, &(statement->returnColumns));
+	return true;
+}
+
+/**
+ * Move the cursor past the next row that passes the filters and
+ * return it in row, or false if there is none left. Only the
+ * columns the statement reads are filled in. Through an index,
+ * every entry in range leads to its row in the table, unless the
+ * index covers the statement. The row is then made up from the
+ * entry, and the columns the index doesn't hold are left empty.
+ */
+bool scanNext(Statement *statement, Cursor *cursor, Row *row)
+{
+	if (!statement->useIndex)
+	{
+		while (!(cursor->endOfTable) && cursorKey(cursor) <= statement->endKey)
+		{
+			bool matches = cursorMatches(statement, cursor, row);
+			cursorAdvance(cursor);
+			if (matches)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	Row entry;
+	while (!(cursor->endOfTable))
+	{
+		Key key = cursorKey(cursor);
+		if (key > statement->indexEnd)
+		{
+			break;
+		}
+
+		uint32_t id = (uint32_t)key;
+		if (id < statement->startKey || id > statement->endKey)
+		{
+			cursorAdvance(cursor);
+			continue;
+		}
+		bool matches;
+		if (statement->indexOnly)
+		{
+			cursorRow(cursor, &entry, NULL);
+			row->id = id;
+			row->values.assign(statement->table->columns.size() - 1, string());
+			for (uint32_t i = 0; i < entry.values.size(); i++)
+			{
+				*rowText(row, statement->index->columns[i]) = entry.values[i];
+			}
+			matches = rowMatches(statement, row);
+		}
+		else
+		{
+			Cursor *row_cursor = table_find(statement->table, id);
+			matches = cursorMatches(statement, row_cursor, row);
+			delete row_cursor;
+		}
+		cursorAdvance(cursor);
+
+		if (matches)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Keys of the rows a delete or update applies to. Rows are only
+ * read when there are filters to check.
+ */
+void collectKeys(Statement *statement, vector<uint32_t> *keys)
+{
+	Cursor *cursor = scanStart(statement);
+	Row row;
+
+	if (statement->filters.empty())
+	{
+		while (!(cursor->endOfTable) && cursorKey(cursor) <= statement->endKey)
+		{
+			keys->push_back((uint32_t)cursorKey(cursor));
+			cursorAdvance(cursor);
+		}
+	}
+	else
+	{
+		while (scanNext(statement, cursor, &row))
+		{
+			keys->push_back(row.id);
+		}
+	}
+
+	delete cursor;
+}
+
+ExecuteResult executeDelete(Statement *statement, Table *table)
+{
+	// Collect the keys first, deleting rebalances the leaves under the cursor
+	vector<uint32_t> keys;
+	collectKeys(statement, &keys);
+
+	Row row;
+	for (uint32_t i = 0; i < keys.size(); i++)
+	{
+		Cursor *cursor = table_find(table, keys[i]);
+		if (!table->indexes.empty())
+		{
+			cursorRow(cursor, &row, NULL);
+			for (uint32_t j = 0; j < table->indexes.size(); j++)
+			{
+				indexDelete(table->indexes[j], &row);
+			}
+		}
+		leaf_node_delete(cursor);
+		delete cursor;
+	}
+
+	return EXECUTE_SUCCESS;
+}
+
+ExecuteResult executeUpdate(Statement *statement, Table *table)
+{
+	Pager *pager = table->pager;
+
+	// Collect the keys first, a record that grows can split its leaf
+	vector<uint32_t> keys;
+	collectKeys(statement, &keys);
+
+	// Indexes that hold assigned columns swap the entry of the old values for one of the new values
+	vector<Index *> indexes;
+	for (uint32_t i = 0; i < table->indexes.size(); i++)
+	{
+		vector<uint32_t> &columns = table->indexes[i]->columns;
+		for (uint32_t j = 0; j < columns.size(); j++)
+		{
+			if (statement->assigned[columns[j]])
+			{
+				indexes.push_back(table->indexes[i]);
+				break;
+			}
+		}
+	}
+
+	Row old_row;
+	Row new_row;
+	for (uint32_t i = 0; i < keys.size(); i++)
+	{
+		Cursor *cursor = table_find(table, keys[i]);
+		if (!indexes.empty())
+		{
+			cursorRow(cursor, &old_row, NULL);
+			new_row = old_row;
+			for (uint32_t j = 1; j < table->columns.size(); j++)
+			{
+				if (statement->assigned[j])
+				{
+					*rowText(&new_row, j) = *rowText(&(statement->row), j);
+				}
+			}
+		}
+
+		char record[ROW_MAX_SIZE];
+		void *node = get_page(pager, cursor->page_num);
+		uint32_t size = updateRow(table, leaf_node_value(node, cursor->cell_num), &(statement->row), statement->assigned, record);
+		unpin_page(pager, cursor->page_num);
+
+		leaf_node_update(cursor, record, size);
+		delete cursor;
+
+		for (uint32_t j = 0; j < indexes.size(); j++)
+		{
+			Row old_entry;
+			Row new_entry;
+			indexEntry(indexes[j], &old_row, &old_entry);
+			indexEntry(indexes[j], &new_row, &new_entry);
+			if (new_entry.values == old_entry.values)
+			{
+				continue;
+			}
+
+			indexDelete(indexes[j], &old_row);
+			vector<Row *> rows(1, &new_row);
+			indexInsert(indexes[j], rows);
+		}
+	}
+
+	return EXECUTE_SUCCESS;
+}
+
+Table *openTable(Pager *pager, uint32_t root_page_num, Statement *create)
+{
+	Table *table = new Table();
 	table->pager = pager;
+	table->root_page_num = root_page_num;
+	table->name = create->name;
+	table->columns = create->definition;
+	return table;
+}
+
+/**
+ * Open the tree of an index and add it to the indexes of its table
+ */
+Index *openIndex(Pager *pager, uint32_t root_page_num, Statement *create)
+{
+	Index *index = new Index();
+	index->name = create->name;
+	index->table = create->table;
+	index->columns = create->columns;
+
+	index->tree = new Table();
+	index->tree->pager = pager;
+	index->tree->root_page_num = root_page_num;
+	index->tree->name = create->name;
+	index->tree->columns.push_back(index->table->columns[0]);
+	for (uint32_t i = 0; i < index->columns.size(); i++)
+	{
+		index->tree->columns.push_back(index->table->columns[index->columns[i]]);
+	}
+
+	index->table->indexes.push_back(index);
+	return index;
+}
+
+/**
+ * Empty root leaf for a new table or index
+ */
+uint32_t allocateRoot(Pager *pager, bool is_index)
+{
+	uint32_t root_page_num = pager_allocate_page(pager);
+	void *root = get_page(pager, root_page_num);
+	initialize_leaf_node(root, is_index);
+	set_node_root(root, true);
+	mark_page_dirty(pager, root_page_num);
+	unpin_page(pager, root_page_num);
+	return root_page_num;
+}
+
+/**
+ * Add the row of a new table or index to the schema table. Nothing
+ * is ever dropped, so the next id is one past the last.
+ */
+void schemaInsert(Database *db, const string &name, uint32_t root_page_num, const string &sql)
+{
+	Row row;
+	row.id = db->tables.size() + db->indexes.size() + 1;
+	row.values.push_back(name);
+	row.values.push_back(to_string(root_page_num));
+	row.values.push_back(sql);
+	Cursor *cursor = table_find(db->schema, row.id);
+	leaf_node_insert(cursor, row.id, &row);
+	delete cursor;
+
+	db->schemaVersion += 1;
+}
+
+/**
+ * Give the new table an empty root leaf and a row in the schema
+ * table, which keeps the columns as a create table statement
+ */
+ExecuteResult executeCreateTable(Statement *statement, Database *db)
+{
+	if (findTable(db, statement->name) != NULL || findIndex(db, statement->name) != NULL)
+	{
+		return EXECUTE_TABLE_EXISTS;
+	}
+
+	uint32_t root_page_num = allocateRoot(db->pager, false);
+	schemaInsert(db, statement->name, root_page_num, tableSql(statement));
+	db->tables.push_back(openTable(db->pager, root_page_num, statement));
+	return EXECUTE_SUCCESS;
+}
+
+/**
+ * Give the new index an empty root leaf and a row in the schema
+ * table, then add the rows its table already has
+ */
+ExecuteResult executeCreateIndex(Statement *statement, Database *db)
+{
+	if (findTable(db, statement->name) != NULL || findIndex(db, statement->name) != NULL)
+	{
+		return EXECUTE_INDEX_EXISTS;
+	}
+
+	uint32_t root_page_num = allocateRoot(db->pager, true);
+	schemaInsert(db, statement->name, root_page_num, indexSql(statement));
+	Index *index = openIndex(db->pager, root_page_num, statement);
+	db->indexes.push_back(index);
+	indexBuild(index);
+	return EXECUTE_SUCCESS;
+}
+
+ExecuteResult executeStatement(Statement *statement, Database *db)
+{
+	switch (statement->type)
+	{
+	case (STATEMENT_INSERT):
+		return executeInsert(statement, statement->table);
+	case (STATEMENT_DELETE):
+		return executeDelete(statement, statement->table);
+	case (STATEMENT_UPDATE):
+		return executeUpdate(statement, statement->table);
+	case (STATEMENT_CREATE_TABLE):
+		return executeCreateTable(statement, db);
+	case (STATEMENT_CREATE_INDEX):
+		return executeCreateIndex(statement, db);
+	case (STATEMENT_SELECT):
+		// Selects return their rows one at a time from statementStep
+		break;
+	}
+
+	return EXECUTE_SUCCESS;
+}
+
+/**
+ * Open the schema table and every table and index it lists. A new
+ * database gets the default table.
+ */
+void loadSchema(Database *db)
+{
+	Statement create;
+	prepareStatement(db, SCHEMA_TABLE_SQL, &create);
+	db->schema = openTable(db->pager, SCHEMA_ROOT_PAGE_NUM, &create);
+
+	Cursor *cursor = tableStart(db->schema);
+	Row row;
+	while (!(cursor->endOfTable))
+	{
+		cursorRow(cursor, &row, NULL);
+		if (prepareStatement(db, row.values[2], &create) != PREPARE_SUCCESS)
+		{
+			printf("Schema of '%s' is corrupt.\n", row.values[0].c_str());
+			exit(EXIT_FAILURE);
+		}
+		uint32_t root_page_num = strtoul(row.values[1].c_str(), NULL, 10);
+		if (create.type == STATEMENT_CREATE_TABLE)
+		{
+			db->tables.push_back(openTable(db->pager, root_page_num, &create));
+		}
+		else if (create.type == STATEMENT_CREATE_INDEX)
+		{
+			db->indexes.push_back(openIndex(db->pager, root_page_num, &create));
+		}
+		else
+		{
+			printf("Schema of '%s' is corrupt.\n", row.values[0].c_str());
+			exit(EXIT_FAILURE);
+		}
+		cursorAdvance(cursor);
+	}
+	delete cursor;
+
+	if (db->tables.empty())
+	{
+		prepareStatement(db, DEFAULT_TABLE_SQL, &create);
+		executeCreateTable(&create, db);
+	}
+}
+
+PreparedStatement *statementPrepare(Database *db, string_view sql, PrepareResult_t *result)
+{
+	PreparedStatement *prepared = new PreparedStatement();
+	prepared->sql = string(sql);
+	*result = prepareStatement(db, prepared->sql, &(prepared->statement));
+	if (*result != PREPARE_SUCCESS)
+	{
+		delete prepared;
+		return NULL;
+	}
+
+	prepared->schemaVersion = db->schemaVersion;
+	prepared->bound.assign(prepared->statement.parameters.size(), false);
+	prepared->cursor = NULL;
+	prepared->done = false;
+	return prepared;
+}
+
+/**
+ * Bind value to the ? at index, counting from 1. The value is
+ * checked like one written into the statement would be.
+ */
+PrepareResult_t statementBind(PreparedStatement *prepared, uint32_t index, string_view value)
+{
+	if (index < 1 || index > prepared->statement.parameters.size())
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	Parameter *parameter = &(prepared->statement.parameters[index - 1]);
+	if (parameter->pattern)
+	{
+		parameter->text->assign(value.data(), value.length());
+	}
+	else if (parameter->column == 0)
+	{
+		PrepareResult_t result = parseKey(value, parameter->key);
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+	else
+	{
+		PrepareResult_t result = parseValue(&(prepared->statement.table->columns[parameter->column]), value, parameter->text);
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+
+	prepared->bound[index - 1] = true;
+	return PREPARE_SUCCESS;
+}
+
+void statementClearBindings(PreparedStatement *prepared)
+{
+	prepared->bound.assign(prepared->bound.size(), false);
+}
+
+/**
+ * Run the statement. A select returns EXECUTE_ROW with the next row
+ * each time and EXECUTE_SUCCESS once there are no more, any other
+ * statement does all its work on the first step.
+ */
+ExecuteResult statementStep(PreparedStatement *prepared, Database *db, Row *row)
+{
+	Statement *statement = &(prepared->statement);
+
+	if (prepared->done)
+	{
+		return EXECUTE_SUCCESS;
+	}
+
+	if (prepared->cursor == NULL)
+	{
+		if (find(prepared->bound.begin(), prepared->bound.end(), false) != prepared->bound.end())
+		{
+			return EXECUTE_UNBOUND_PARAMETER;
+		}
+
+		resolveKeyRange(statement);
+		resolveIndexRange(statement);
+		if (statement->type != STATEMENT_SELECT)
+		{
+			prepared->done = true;
+			return executeStatement(statement, db);
+		}
+		prepared->cursor = scanStart(statement);
+	}
+
+	if (scanNext(statement, prepared->cursor, row))
+	{
+		return EXECUTE_ROW;
+	}
+
+	prepared->done = true;
+	return EXECUTE_SUCCESS;
+}
+
+/**
+ * Get the statement ready to run again, bound values are kept
+ */
+void statementReset(PreparedStatement *prepared)
+{
+	delete prepared->cursor;
+	prepared->cursor = NULL;
+	prepared->done = false;
+}
+
+void statementFinalize(PreparedStatement *prepared)
+{
+	statementReset(prepared);
+	delete prepared;
+}
+
+PlanCache *planCacheNew(uint32_t capacity)
+{
+	PlanCache *cache = new PlanCache();
+	cache->capacity = capacity;
+	cache->hits = 0;
+	cache->misses = 0;
+	return cache;
+}
+
+/**
+ * Prepared statement for sql, reset and with no values bound. Only
+ * a miss lexes, parses and plans the statement. Statements that
+ * fail to prepare are not cached and NULL is returned. A plan made
+ * before a table or index was created may not use the new index,
+ * so it is dropped and planned again.
+ */
+PreparedStatement *planCacheGet(Database *db, string_view sql, PrepareResult_t *result)
+{
+	PlanCache *cache = db->planCache;
+	size_t start = 0;
+	size_t end = sql.length();
+	while (start < end && isSpace(sql[start]))
+	{
+		start += 1;
+	}
+	while (end > start && (isSpace(sql[end - 1]) || sql[end - 1] == ';'))
+	{
+		end -= 1;
+	}
+	string key(sql.substr(start, end - start));
+
+	unordered_map<string, PreparedStatement *>::iterator entry = cache->plans.find(key);
+	if (entry != cache->plans.end() && entry->second->schemaVersion != db->schemaVersion)
+	{
+		cache->lru.erase(entry->second->lruPosition);
+		statementFinalize(entry->second);
+		cache->plans.erase(entry);
+		entry = cache->plans.end();
+	}
+	if (entry != cache->plans.end())
+	{
+		PreparedStatement *prepared = entry->second;
+		cache->lru.splice(cache->lru.begin(), cache->lru, prepared->lruPosition);
+		cache->hits += 1;
+		statementReset(prepared);
+		statementClearBindings(prepared);
+		*result = PREPARE_SUCCESS;
+		return prepared;
+	}
+
+	cache->misses += 1;
+	PreparedStatement *prepared = statementPrepare(db, key, result);
+	if (prepared == NULL)
+	{
+		return NULL;
+	}
+
+	cache->lru.push_front(prepared);
+	prepared->lruPosition = cache->lru.begin();
+	cache->plans[key] = prepared;
+
+	if (cache->lru.size() > cache->capacity)
+	{
+		PreparedStatement *victim = cache->lru.back();
+		cache->lru.pop_back();
+		cache->plans.erase(victim->sql);
+		statementFinalize(victim);
+	}
+
+	return prepared;
+}
+
+void planCacheClear(PlanCache *cache)
+{
+	for (list<PreparedStatement *>::iterator prepared = cache->lru.begin(); prepared != cache->lru.end(); prepared++)
+	{
+		statementFinalize(*prepared);
+	}
+	cache->lru.clear();
+	cache->plans.clear();
+}
+
+/**
+ * Prepare a statement of the REPL or a script through the plan
+ * cache and bind the values of .bind to its parameters
+ */
+PrepareResult_t prepareCached(Database *db, string_view input, PreparedStatement **prepared)
+{
+	PrepareResult_t result;
+	*prepared = planCacheGet(db, input, &result);
+	if (*prepared == NULL)
+	{
+		return result;
+	}
+
+	uint32_t count = min(db->bindings.size(), (*prepared)->statement.parameters.size());
+	for (uint32_t i = 0; i < count; i++)
+	{
+		result = statementBind(*prepared, i + 1, db->bindings[i]);
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * Run a prepared statement to the end, printing the rows of a select
+ */
+ExecuteResult executePrepared(PreparedStatement *prepared, Database *db)
+{
+	Row row;
+	ExecuteResult result;
+	while ((result = statementStep(prepared, db, &row)) == EXECUTE_ROW)
+	{
+		printRow(prepared->statement.table, &row, prepared->statement.columns);
+	}
+	statementReset(prepared);
+	return result;
+}
+
+/**
+ * .import sorts its input with an external merge sort. Rows are
+ * collected until they take IMPORT_RUN_BYTES of memory, then sorted
+ * and spilled to a temporary file as one run. The runs are merged
+ * back in key order while the tree is built.
+ */
+const uint64_t IMPORT_RUN_BYTES = 64 << 20;
+const uint32_t IMPORT_DEFAULT_FILL_PERCENT = 90;
+const uint32_t IMPORT_MIN_FILL_PERCENT = 50;
+
+struct SortRun
+{
+	FILE *file;
+	Row row; // Next row of the run
+};
+
+struct RowSorter
+{
+	uint32_t numValues; // Values of each row besides the key
+	vector<Row> rows; // Rows not spilled yet
+	uint64_t rowsBytes;
+	size_t next; // Next row to return when nothing was spilled
+	vector<SortRun> runs;
+	// Key and run of the next row of every run that is not used up
+	priority_queue<pair<uint32_t, uint32_t>, vector<pair<uint32_t, uint32_t>>, greater<pair<uint32_t, uint32_t>>> heads;
+};
+
+void writeRunString(FILE *file, const string &value)
+{
+	uint32_t length = value.length();
+	fwrite(&length, sizeof(length), 1, file);
+	fwrite(value.data(), 1, length, file);
+}
+
+bool readRunString(FILE *file, string *value)
+{
+	uint32_t length;
+	if (fread(&length, sizeof(length), 1, file) != 1)
+	{
+		return false;
+	}
+	value->resize(length);
+	return fread(&(*value)[0], 1, length, file) == length;
+}
+
+bool readRunRow(FILE *file, uint32_t num_values, Row *row)
+{
+	if (fread(&(row->id), sizeof(row->id), 1, file) != 1)
+	{
+		return false;
+	}
+
+	row->values.resize(num_values);
+	for (uint32_t i = 0; i < num_values; i++)
+	{
+		if (!readRunString(file, &(row->values[i])))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Sort the rows held in memory and write them out as a new run
+ */
+void rowSorterSpill(RowSorter *sorter)
+{
+	FILE *file = tmpfile();
+	if (file == NULL)
+	{
+		printf("Unable to create a temporary file: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	stable_sort(sorter->rows.begin(), sorter->rows.end(), rowIdLess);
+	for (uint32_t i = 0; i < sorter->rows.size(); i++)
+	{
+		fwrite(&(sorter->rows[i].id), sizeof(sorter->rows[i].id), 1, file);
+		for (uint32_t j = 0; j < sorter->numValues; j++)
+		{
+			writeRunString(file, sorter->rows[i].values[j]);
+		}
+	}
+	if (fflush(file) != 0)
+	{
+		printf("Error writing temporary file: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	SortRun run = {};
+	run.file = file;
+	sorter->runs.push_back(run);
+	sorter->rows.clear();
+	sorter->rowsBytes = 0;
+}
+
+void rowSorterAdd(RowSorter *sorter, Row *row)
+{
+	sorter->rowsBytes += sizeof(Row);
+	for (uint32_t i = 0; i < row->values.size(); i++)
+	{
+		sorter->rowsBytes += sizeof(string) + row->values[i].length();
+	}
+	sorter->rows.push_back(Row());
+	swap(sorter->rows.back(), *row);
+
+	if (sorter->rowsBytes >= IMPORT_RUN_BYTES)
+	{
+		rowSorterSpill(sorter);
+	}
+}
+
+/**
+ * Called once all rows were added. Input that fits in memory is
+ * sorted where it is, and only needs sorting at all if it is not in
+ * key order already.
+ */
+void rowSorterFinish(RowSorter *sorter)
+{
+	sorter->next = 0;
+
+	if (sorter->runs.empty())
+	{
+		if (!is_sorted(sorter->rows.begin(), sorter->rows.end(), rowIdLess))
+		{
+			stable_sort(sorter->rows.begin(), sorter->rows.end(), rowIdLess);
+		}
+		return;
+	}
+
+	if (!sorter->rows.empty())
+	{
+		rowSorterSpill(sorter);
+	}
+
+	for (uint32_t i = 0; i < sorter->runs.size(); i++)
+	{
+		rewind(sorter->runs[i].file);
+		if (readRunRow(sorter->runs[i].file, sorter->numValues, &(sorter->runs[i].row)))
+		{
+			sorter->heads.push(make_pair(sorter->runs[i].row.id, i));
+		}
+	}
+}
+
+/**
+ * Next row in key order. Rows with the same key come out in the
+ * order they were added, since earlier runs hold earlier rows.
+ */
+bool rowSorterNext(RowSorter *sorter, Row *row)
+{
+	if (sorter->runs.empty())
+	{
+		if (sorter->next == sorter->rows.size())
+		{
+			return false;
+		}
+		swap(*row, sorter->rows[sorter->next]);
+		sorter->next += 1;
+		return true;
+	}
+
+	if (sorter->heads.empty())
+	{
+		return false;
+	}
+
+	uint32_t run_num = sorter->heads.top().second;
+	sorter->heads.pop();
+	SortRun *run = &(sorter->runs[run_num]);
+	swap(*row, run->row);
+	if (readRunRow(run->file, sorter->numValues, &(run->row)))
+	{
+		sorter->heads.push(make_pair(run->row.id, run_num));
+	}
+	return true;
+}
+
+void rowSorterClose(RowSorter *sorter)
+{
+	for (uint32_t i = 0; i < sorter->runs.size(); i++)
+	{
+		fclose(sorter->runs[i].file);
+	}
+}
+
+/**
+ * State of table_bulk_load. Every level above the leaves has one
+ * open node that the finished nodes of the level below are added
+ * to, open[0] being the parent of the leaves.
+ */
+struct BulkLoader
+{
+	Table *table;
+	uint32_t leafLimit; // Bytes of slots and records a leaf is filled to
+	uint32_t keyLimit;	// Keys an internal node is filled to
+	vector<uint32_t> open;
+	vector<Key> rightMax; // Max key under the right child of each open node
+};
+
+/**
+ * Add a finished node to the open node of level. A full open node
+ * is finished itself, added to the level above and replaced with a
+ * new one.
+ */
+void bulk_add_child(BulkLoader *loader, uint32_t level, uint32_t child_page_num, Key child_max)
+{
+	Pager *pager = loader->table->pager;
+
+	if (level == loader->open.size())
+	{
+		uint32_t new_page_num = pager_allocate_page(pager);
+		initialize_internal_node(get_page(pager, new_page_num), false);
+		mark_page_dirty(pager, new_page_num);
+		unpin_page(pager, new_page_num);
+		loader->open.push_back(new_page_num);
+		loader->rightMax.push_back(0);
+	}
+
+	uint32_t page_num = loader->open[level];
+	void *node = get_page(pager, page_num);
+
+	if (*internal_node_right_child(node) != INVALID_PAGE_NUM)
+	{
+		uint32_t num_keys = *internal_node_num_keys(node);
+		if (num_keys >= loader->keyLimit)
+		{
+			unpin_page(pager, page_num);
+			bulk_add_child(loader, level + 1, page_num, loader->rightMax[level]);
+
+			page_num = pager_allocate_page(pager);
+			node = get_page(pager, page_num);
+			initialize_internal_node(node, false);
+			loader->open[level] = page_num;
+		}
+		else
+		{
+			// The right child moves into a cell, keyed by its max
+			*internal_node_cell(node, num_keys) = *internal_node_right_child(node);
+			set_internal_node_key(node, num_keys, loader->rightMax[level]);
+			*internal_node_num_keys(node) = num_keys + 1;
+		}
+	}
+
+	*internal_node_right_child(node) = child_page_num;
+	loader->rightMax[level] = child_max;
+	mark_page_dirty(pager, page_num);
+	unpin_page(pager, page_num);
+
+	update_node_parent(pager, child_page_num, page_num);
+}
+
+void bulk_finish_leaf(BulkLoader *loader, uint32_t page_num, void *leaf)
+{
+	Pager *pager = loader->table->pager;
+	Key max_key = leaf_node_key(leaf, *leaf_node_num_cells(leaf) - 1);
+	mark_page_dirty(pager, page_num);
+	unpin_page(pager, page_num);
+	bulk_add_child(loader, 0, page_num, max_key);
+}
+
+/**
+ * Page numbers of the right-most node of every level, root first
+ */
+void table_right_spine(Table *table, vector<uint32_t> *spine)
+{
+	Pager *pager = table->pager;
+	spine->clear();
+
+	uint32_t page_num = table->root_page_num;
+	while (true)
+	{
+		spine->push_back(page_num);
+		void *node = get_page(pager, page_num);
+		bool leaf = get_node_type(node) == NODE_LEAF;
+		uint32_t child_page_num = leaf ? 0 : *internal_node_right_child(node);
+		unpin_page(pager, page_num);
+		if (leaf)
+		{
+			return;
+		}
+		page_num = child_page_num;
+	}
+}
+
+/**
+ * Load rows into an empty table by building the tree bottom-up.
+ * Leaves are packed left to right up to fill_percent of a page and
+ * each finished node is appended to its parent, so no node is ever
+ * searched or split and every page is written about once. Rows whose
+ * key was already loaded are skipped and counted in duplicates.
+ */
+uint64_t table_bulk_load(Table *table, RowSorter *sorter, uint32_t fill_percent, uint64_t *duplicates)
+{
+	Pager *pager = table->pager;
+
+	BulkLoader loader;
+	loader.table = table;
+	loader.leafLimit = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+	loader.keyLimit = INTERNAL_NODE_MAX_KEYS * fill_percent / 100;
+
+	uint32_t page_num = INVALID_PAGE_NUM;
+	void *leaf = NULL;
+	uint32_t leaf_used = 0;
+	uint64_t loaded = 0;
+	Row row;
+
+	while (rowSorterNext(sorter, &row))
+	{
+		if (leaf != NULL && row.id == leaf_node_key(leaf, *leaf_node_num_cells(leaf) - 1))
+		{
+			*duplicates += 1;
+			continue;
+		}
+
+		char record[ROW_MAX_SIZE];
+		uint32_t size = serializeRow(table, &row, record);
+
+		if (leaf == NULL || leaf_used + LEAF_NODE_SLOT_SIZE + size > loader.leafLimit)
+		{
+			uint32_t new_page_num = pager_allocate_page(pager);
+			void *new_leaf = get_page(pager, new_page_num);
+			initialize_leaf_node(new_leaf, false);
+
+			if (leaf != NULL)
+			{
+				*leaf_node_next_leaf(leaf) = new_page_num;
+				bulk_finish_leaf(&loader, page_num, leaf);
+			}
+			page_num = new_page_num;
+			leaf = new_leaf;
+			leaf_used = 0;
+		}
+
+		leaf_node_insert_cell(leaf, *leaf_node_num_cells(leaf), row.id, record, size);
+		leaf_used += LEAF_NODE_SLOT_SIZE + size;
+		loaded += 1;
+	}
+
+	if (leaf == NULL)
+	{
+		return 0;
+	}
+	bulk_finish_leaf(&loader, page_num, leaf);
+
+	// Close the open nodes bottom-up, the last one is the top of the tree
+	for (uint32_t level = 0; level + 1 < loader.open.size(); level++)
+	{
+		bulk_add_child(&loader, level + 1, loader.open[level], loader.rightMax[level]);
+	}
+	uint32_t top_page_num = loader.open.back();
+
+	// Hang the tree off the root page, then pull it up into the root
+	void *root = get_page(pager, table->root_page_num);
+	initialize_internal_node(root, false);
+	set_node_root(root, true);
+	*internal_node_right_child(root) = top_page_num;
+	mark_page_dirty(pager, table->root_page_num);
+	unpin_page(pager, table->root_page_num);
+	update_node_parent(pager, top_page_num, table->root_page_num);
+
+	while (true)
+	{
+		root = get_page(pager, table->root_page_num);
+		bool collapse = get_node_type(root) == NODE_INTERNAL && *internal_node_num_keys(root) == 0;
+		unpin_page(pager, table->root_page_num);
+		if (!collapse)
+		{
+			break;
+		}
+		table_collapse_root(table);
+	}
+
+	/**
+	 * Only the last node of each level can be underfull, possibly
+	 * down to a single child. Fix them top-down, so every node that
+	 * is rebalanced has a parent with a sibling to offer. A merge
+	 * can collapse the root, which moves the levels below up one.
+	 */
+	vector<uint32_t> spine;
+	table_right_spine(table, &spine);
+	for (uint32_t depth = 1; depth < spine.size(); depth++)
+	{
+		uint32_t height = spine.size();
+		node_rebalance(table, spine[depth]);
+		table_right_spine(table, &spine);
+		depth -= height - spine.size();
+	}
+
+	return loaded;
+}
+
+/**
+ * Split a CSV or TSV line into fields. Fields may be double quoted,
+ * with "" standing for a quote inside them.
+ */
+bool splitImportLine(const string &line, char delimiter, vector<string> *fields)
+{
+	fields->clear();
+	string field;
+	size_t i = 0;
+
+	while (true)
+	{
+		field.clear();
+		if (i < line.length() && line[i] == '"')
+		{
+			i += 1;
+			while (true)
+			{
+				if (i >= line.length())
+				{
+					return false;
+				}
+				if (line[i] == '"')
+				{
+					if (i + 1 < line.length() && line[i + 1] == '"')
+					{
+						field += '"';
+						i += 2;
+						continue;
+					}
+					i += 1;
+					break;
+				}
+				field += line[i];
+				i += 1;
+			}
+			if (i < line.length() && line[i] != delimiter)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			size_t end = line.find(delimiter, i);
+			if (end == string::npos)
+			{
+				end = line.length();
+			}
+			field = line.substr(i, end - i);
+			i = end;
+		}
+
+		fields->push_back(field);
+		if (i >= line.length())
+		{
+			return true;
+		}
+		i += 1; // Skip the delimiter
+	}
+}
+
+PrepareResult_t parseImportLine(string line, char delimiter, Table *table, Row *row)
+{
+	if (!line.empty() && line[line.length() - 1] == '\r')
+	{
+		line.erase(line.length() - 1);
+	}
+
+	vector<string> fields;
+	if (!splitImportLine(line, delimiter, &fields) || fields.size() != table->columns.size())
+	{
+		return PREPARE_SYNTAX_ERROR;
+	}
+
+	PrepareResult_t result = parseKey(fields[0], &(row->id));
+	if (result != PREPARE_SUCCESS)
+	{
+		return result;
+	}
+
+	row->values.resize(fields.size() - 1);
+	for (uint32_t i = 1; i < fields.size(); i++)
+	{
+		result = parseValue(&(table->columns[i]), fields[i], &(row->values[i - 1]));
+		if (result != PREPARE_SUCCESS)
+		{
+			return result;
+		}
+	}
+	return PREPARE_SUCCESS;
+}
+
+/**
+ * .import <filename> [table] [fill_percent]
+ * Load rows with a field for every column of the table from a CSV
+ * file, or a TSV file if the first line has a tab in it. A first
+ * line starting with the key column name is a header. The whole file is read and checked before
+ * the table is touched. Unless a script commits it later, the load
+ * commits as one transaction.
+ * An empty table is built bottom-up, rows for a table that already
+ * has some are inserted one by one in key order.
+ */
+void importFile(Table *table, string filename, uint32_t fill_percent, bool commit)
+{
+	ifstream file(filename.c_str());
+	if (!file.is_open())
+	{
+		printf("Unable to open file '%s'.\n", filename.c_str());
+		return;
+	}
+
+	RowSorter sorter;
+	sorter.numValues = table->columns.size() - 1;
+	sorter.rowsBytes = 0;
+
+	char delimiter = ',';
+	string line;
+	uint64_t line_num = 0;
+	while (getline(file, line))
+	{
+		line_num += 1;
+		if (line_num == 1)
+		{
+			delimiter = line.find('\t') != string::npos ? '\t' : ',';
+			string key_name = table->columns[0].name;
+			if (line.compare(0, key_name.length(), key_name) == 0 || line.compare(0, key_name.length() + 2, "\"" + key_name + "\"") == 0)
+			{
+				continue;
+			}
+		}
+
+		if (line.empty() || line == "\r")
+		{
+			continue;
+		}
+
+		Row row;
+		switch (parseImportLine(line, delimiter, table, &row))
+		{
+		case (PREPARE_SUCCESS):
+			rowSorterAdd(&sorter, &row);
+			continue;
+		case (PREPARE_STRING_TOO_LONG):
+			printf("String is too long on line %llu.\n", (unsigned long long)line_num);
+			break;
+		case (PREPARE_NEGATIVE_ID):
+			printf("ID must be positive on line %llu.\n", (unsigned long long)line_num);
+			break;
+		default:
+			printf("Could not parse line %llu.\n", (unsigned long long)line_num);
+			break;
+		}
 
-	if (pager->numPages == 0)
-	{
-		/**
-		 * New database file.
-		 * Initialize page 0 as leaf node.
-		 */
-		void *root_node = get_page(pager, 0);
-		initialize_leaf_node(root_node);
+		rowSorterClose(&sorter);
+		return;
 	}
+	rowSorterFinish(&sorter);
 
-	return table;
-}
+	void *root = get_page(table->pager, table->root_page_num);
+	bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+	unpin_page(table->pager, table->root_page_num);
 
-void serializeRow(Row *source, void *destination)
-{
-	memcpy((char *)destination + ID_OFFSET, &(source->id), ID_SIZE);
-	memcpy((char *)destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-	memcpy((char *)destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
-}
+	uint64_t loaded = 0;
+	uint64_t duplicates = 0;
+	if (empty)
+	{
+		// The indexes are just as empty, they are filled once the table is
+		loaded = table_bulk_load(table, &sorter, fill_percent, &duplicates);
+		for (uint32_t i = 0; i < table->indexes.size(); i++)
+		{
+			indexBuild(table->indexes[i]);
+		}
+	}
+	else
+	{
+		Statement statement;
+		statement.type = STATEMENT_INSERT;
+		statement.rows.resize(1);
+		while (rowSorterNext(&sorter, &(statement.rows[0])))
+		{
+			if (executeInsert(&statement, table) == EXECUTE_DUPLICATE_KEY)
+			{
+				duplicates += 1;
+			}
+			else
+			{
+				loaded += 1;
+			}
+		}
+	}
+	rowSorterClose(&sorter);
 
-void deserializeRow(void *source, Row *destination)
-{
-	memcpy(&(destination->id), (char *)source + ID_OFFSET, ID_SIZE);
-	memcpy(&(destination->username), (char *)source + USERNAME_OFFSET, USERNAME_SIZE);
-	memcpy(&(destination->email), (char *)source + EMAIL_OFFSET, EMAIL_SIZE);
+	if (commit)
+	{
+		pager_commit(table->pager);
+	}
+
+	printf("Imported %llu rows.\n", (unsigned long long)loaded);
+	if (duplicates > 0)
+	{
+		printf("Skipped %llu rows with duplicate keys.\n", (unsigned long long)duplicates);
+	}
 }
 
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value)
+int metaCommand(string command, Database *db)
 {
-	void *node = get_page(cursor->table->pager, cursor->page_num);
-
-	uint32_t num_cells = *leaf_node_num_cells(node);
-	if (num_cells >= LEAF_NODE_MAX_CELLS)
+	if (command.compare(".exit") == 0)
 	{
-		// Node full
-		printf("Need to implement splitting a leaf node \n");
-		exit(EXIT_FAILURE);
+		db_close(db, true);
+		exit(0);
 	}
-
-	if (cursor->cell_num < num_cells)
+	else if (command.compare(".constants") == 0)
+	{
+		printf("Constants:\n");
+		print_constants();
+		return META_COMMAND_SUCCESS;
+	}
+	else if (command.compare(".stats") == 0)
+	{
+		printf("Stats:\n");
+		print_stats(db->pager);
+		printf("plan cache hits: %llu\n", (unsigned long long)db->planCache->hits);
+		printf("plan cache misses: %llu\n", (unsigned long long)db->planCache->misses);
+		return META_COMMAND_SUCCESS;
+	}
+	else if (command == ".btree" || command.compare(0, 7, ".btree ") == 0)
+	{
+		// .btree [table | index]
+		string name = command.length() > 7 ? trim(command.substr(7)) : DEFAULT_TABLE_NAME;
+		Table *table = findTable(db, name);
+		if (table == NULL && findIndex(db, name) != NULL)
+		{
+			table = findIndex(db, name)->tree;
+		}
+		if (table == NULL)
+		{
+			printf("Unknown table.\n");
+			return META_COMMAND_SUCCESS;
+		}
+		printf("Tree:\n");
+		print_tree(db->pager, table->root_page_num, 0);
+		return META_COMMAND_SUCCESS;
+	}
+	else if (command == ".bind" || command.compare(0, 6, ".bind ") == 0)
 	{
-		// Make room for new cell
-		for (uint32_t i = num_cells; i > cursor->cell_num; i--)
+		// .bind <value> ... sets the values of the ? of the statements that follow
+		db->bindings.clear();
+		Lexer lexer;
+		lexer.input = command;
+		lexer.position = 5;
+		while (true)
 		{
-			memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+			lexerSkipSpace(&lexer);
+			if (lexer.position == lexer.input.length())
+			{
+				break;
+			}
+			Token token = lexerValue(&lexer);
+			if (token.type != TOKEN_WORD && token.type != TOKEN_STRING)
+			{
+				printf("Usage: .bind <value> ...\n");
+				db->bindings.clear();
+				break;
+			}
+			db->bindings.push_back(tokenText(token));
 		}
+		return META_COMMAND_SUCCESS;
 	}
+	else if (command.compare(0, 8, ".import ") == 0)
+	{
+		stringstream ss;
+		ss << command.substr(8);
+		vector<string> arguments;
+		string argument;
+		while (ss >> argument)
+		{
+			arguments.push_back(argument);
+		}
 
-	*(leaf_node_num_cells(node)) += 1;
-	*(leaf_node_key(node, cursor->cell_num)) = key;
-	serializeRow(value, leaf_node_value(node, cursor->cell_num));
-}
+		// Table names never start with a digit, fill factors always do
+		string name = DEFAULT_TABLE_NAME;
+		uint32_t fill_percent = IMPORT_DEFAULT_FILL_PERCENT;
+		size_t next = 1;
+		if (next < arguments.size() && !isdigit((unsigned char)arguments[next][0]))
+		{
+			name = arguments[next];
+			next += 1;
+		}
+		if (next < arguments.size() && parseKey(arguments[next], &fill_percent) == PREPARE_SUCCESS)
+		{
+			next += 1;
+		}
+		if (arguments.empty() || next != arguments.size())
+		{
+			printf("Usage: .import <filename> [table] [fill_percent]\n");
+			return META_COMMAND_SUCCESS;
+		}
+		if (fill_percent < IMPORT_MIN_FILL_PERCENT || fill_percent > 100)
+		{
+			printf("Fill factor must be between %d and 100 percent.\n", IMPORT_MIN_FILL_PERCENT);
+			return META_COMMAND_SUCCESS;
+		}
 
-void *cursorValue(Cursor *cursor)
-{
-	uint32_t page_num = cursor->page_num;
-	void *page = get_page(cursor->table->pager, page_num);
+		Table *table = findTable(db, name);
+		if (table == NULL || table == db->schema)
+		{
+			printf(table == NULL ? "Unknown table.\n" : "Table is read-only.\n");
+			return META_COMMAND_SUCCESS;
+		}
+		importFile(table, arguments[0], fill_percent, !db->inScript);
+		return META_COMMAND_SUCCESS;
+	}
 
-	return leaf_node_value(page, cursor->cell_num);
+	return META_COMMAND_UNRECOGNIZED_COMMAND;
 }
 
-void cursorAdvance(Cursor *cursor)
+/**
+ * Lines are read straight from the file descriptor so we always
+ * know whether another statement is already waiting.
+ */
+struct InputBuffer
 {
-	uint32_t page_num = cursor->page_num;
-	void *node = get_page(cursor->table->pager, page_num);
-
-	cursor->cell_num += 1;
+	int file_descriptor;
+	string buffer;
+	size_t start; // Beginning of the first unread line
+	bool eof;
+};
 
-	if (cursor->cell_num >= (*leaf_node_num_cells(node)))
-	{
-		cursor->endOfTable = true;
-	}
+InputBuffer *newInputBuffer(int file_descriptor)
+{
+	InputBuffer *input = new InputBuffer();
+	input->file_descriptor = file_descriptor;
+	input->start = 0;
+	input->eof = false;
+	return input;
 }
 
-PrepareResult_t prepareInsert(string input, Statement *statement)
+bool readInput(InputBuffer *input, string *line)
 {
-	statement->type = STATEMENT_INSERT;
+	while (true)
+	{
+		size_t newline = input->buffer.find('\n', input->start);
+		if (newline != string::npos)
+		{
+			*line = input->buffer.substr(input->start, newline - input->start);
+			input->start = newline + 1;
+			return true;
+		}
 
-	string id_string;
-	string username;
-	string email;
+		if (input->eof)
+		{
+			if (input->start < input->buffer.size())
+			{
+				// Last line without a newline
+				*line = input->buffer.substr(input->start);
+				input->start = input->buffer.size();
+				return true;
+			}
+			return false;
+		}
 
-	stringstream ss;
-	ss << input.substr(6);
-	ss >> id_string >> username >> email;
+		input->buffer.erase(0, input->start);
+		input->start = 0;
 
-	if (ss.fail() || id_string.empty() || username.empty() || email.empty())
-	{
-		return PREPARE_SYNTAX_ERROR;
+		char chunk[4096];
+		ssize_t bytes_read = read(input->file_descriptor, chunk, sizeof(chunk));
+		if (bytes_read <= 0)
+		{
+			input->eof = true;
+		}
+		else
+		{
+			input->buffer.append(chunk, bytes_read);
+		}
 	}
+}
 
-	int id = stoi(id_string);
-
-	if (id < 0)
+/**
+ * Whether readInput would return without blocking, waiting up
+ * to timeout_us for more input to arrive.
+ */
+bool inputPending(InputBuffer *input, int64_t timeout_us)
+{
+	if (input->eof || input->buffer.find('\n', input->start) != string::npos)
 	{
-		return PREPARE_NEGATIVE_ID;
+		return true;
 	}
 
-	if (username.length() > COLUMN_USERNAME_SIZE || email.length() > COLUMN_EMAIL_SIZE)
-	{
-		return PREPARE_STRING_TOO_LONG;
-	}
+	struct pollfd pfd;
+	pfd.fd = input->file_descriptor;
+	pfd.events = POLLIN;
+	struct timespec timeout;
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_nsec = (timeout_us % 1000000) * 1000;
 
-	statement->row.id = id;
-	strcpy(statement->row.username, username.c_str());
-	strcpy(statement->row.email, email.c_str());
+	return ppoll(&pfd, 1, &timeout, NULL) > 0;
+}
 
-	return PREPARE_SUCCESS;
+int64_t nowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
-int prepareStatement(string input, Statement *statement)
+/**
+ * Group commit. A write statement's commit is appended to the log
+ * but its reply is held back. More writes join the group while
+ * they keep arriving within the window, and one log sync then
+ * makes the whole group durable before the replies go out.
+ */
+struct CommitGroup
+{
+	uint32_t size;
+	uint64_t lsn;	   // Commit LSN of the latest member
+	int64_t startedUs; // When the first member joined
+	string replies;	   // Output held back until the group is durable
+};
+
+// Write output, or hold it back while a commit group is open
+void reply(CommitGroup *group, string text)
 {
-	if (input.substr(0, 6) == "insert")
+	if (group->size > 0)
 	{
-		return prepareInsert(input, statement);
+		group->replies += text;
 	}
-	else if (input == "select")
+	else
 	{
-		statement->type = STATEMENT_SELECT;
-		return PREPARE_SUCCESS;
+		cout << text;
 	}
-
-	return PREPARE_UNRECOGNIZED_STATEMENT;
-}
-
-void printRow(Row *row)
-{
-	cout << "(" << row->id << ", " << row->username << ", " << row->email << ")" << endl;
 }
 
-void print_leaf_node(void *node)
+void commitGroupRelease(CommitGroup *group, Database *db)
 {
-	uint32_t num_cells = *leaf_node_num_cells(node);
-	printf("leaf (size %d)\n", num_cells);
-	for (uint32_t i = 0; i < num_cells; i++)
+	if (group->size == 0)
 	{
-		uint32_t key = *leaf_node_key(node, i);
-		printf("  - %d : %d\n", i, key);
+		return;
 	}
+
+	wal_sync_to(db->pager->wal, group->lsn);
+	cout << group->replies << flush;
+
+	group->size = 0;
+	group->replies.clear();
 }
 
-void print_constants()
+string prepareErrorMessage(int result, string input)
 {
-	printf("ROW_SIZE: %d\n", ROW_SIZE);
-	printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-	printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-	printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-	printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-	printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+	switch (result)
+	{
+	case (PREPARE_SYNTAX_ERROR):
+		return "Syntax error. Could not parse statement";
+	case (PREPARE_UNRECOGNIZED_STATEMENT):
+		return "Unrecognized keyword at start of '" + input + "'";
+	case (PREPARE_STRING_TOO_LONG):
+		return "String is too long.";
+	case (PREPARE_UNKNOWN_TABLE):
+		return "Unknown table.";
+	case (PREPARE_READ_ONLY_TABLE):
+		return "Table is read-only.";
+	case (PREPARE_ROW_TOO_LARGE):
+		return "Rows of the table would not fit a page.";
+	case (PREPARE_ENTRY_TOO_LARGE):
+		return "Entries of the index would not fit a page.";
+	default:
+		return "ID must be positive.";
+	}
 }
 
-ExecuteResult executeInsert(Statement *statement, Table *table)
+const char *executeResultMessage(ExecuteResult result)
 {
-	void *node = get_page(table->pager, table->root_page_num);
-	if ((*leaf_node_num_cells(node) >= LEAF_NODE_MAX_CELLS))
+	switch (result)
 	{
-		return EXECUTE_TABLE_FULL;
+	case (EXECUTE_DUPLICATE_KEY):
+		return "Error: Duplicate key.";
+	case (EXECUTE_UNBOUND_PARAMETER):
+		return "Error: Parameter not bound.";
+	case (EXECUTE_TABLE_EXISTS):
+		return "Error: Table already exists.";
+	case (EXECUTE_INDEX_EXISTS):
+		return "Error: Index already exists.";
+	default:
+		return "Executed.";
 	}
+}
 
-	Row *rowToInsert = &(statement->row);
-	Cursor *cursor = tableEnd(table);
+/**
+ * Non-interactive mode for -f and -c. Statements run without
+ * prompts or acknowledgements, only select results and errors are
+ * printed, each error with the line it came from, and a summary
+ * line at the end. All statements form one implicit transaction
+ * that is committed and synced once at the end, .import included.
+ * The first statement that fails ends the script and nothing is
+ * committed, db_close then rolls the transaction back.
+ * Returns the number of statements that failed.
+ */
+uint64_t runScript(Database *db, InputBuffer *input)
+{
+	uint64_t line_num = 0;
+	uint64_t executed = 0;
+	uint64_t failed = 0;
+	string line;
 
-	leaf_node_insert(cursor, rowToInsert->id, rowToInsert);
+	db->inScript = true;
+	while (failed == 0 && readInput(input, &line))
+	{
+		line_num += 1;
+		line = trim(line);
+		if (line.empty() || line.compare(0, 2, "--") == 0)
+		{
+			continue;
+		}
 
-	delete cursor;
+		executed += 1;
+		if (line[0] == '.')
+		{
+			if (line == ".exit")
+			{
+				executed -= 1;
+				break;
+			}
+			if (metaCommand(line, db) == META_COMMAND_UNRECOGNIZED_COMMAND)
+			{
+				printf("line %llu: Unrecognized command '%s'\n", (unsigned long long)line_num, line.c_str());
+				failed += 1;
+			}
+			continue;
+		}
 
-	return EXECUTE_SUCCESS;
-}
+		PreparedStatement *prepared;
+		int prepareResult = prepareCached(db, line, &prepared);
+		if (prepareResult != PREPARE_SUCCESS)
+		{
+			printf("line %llu: %s\n", (unsigned long long)line_num, prepareErrorMessage(prepareResult, line).c_str());
+			failed += 1;
+			continue;
+		}
 
-ExecuteResult executeSelect(Statement *statement, Table *table)
-{
-	Cursor *cursor = tableStart(table);
-	Row row;
+		ExecuteResult result = executePrepared(prepared, db);
+		if (result != EXECUTE_SUCCESS)
+		{
+			printf("line %llu: %s\n", (unsigned long long)line_num, executeResultMessage(result));
+			failed += 1;
+		}
+	}
 
-	while (!(cursor->endOfTable))
+	if (failed == 0)
 	{
-		deserializeRow(cursorValue(cursor), &row);
-		printRow(&row);
-		cursorAdvance(cursor);
+		pager_commit(db->pager);
 	}
+	printf("Executed %llu statements, %llu failed.%s\n", (unsigned long long)executed, (unsigned long long)failed, failed > 0 ? " Rolled back." : "");
 
-	delete cursor;
-
-	return EXECUTE_SUCCESS;
+	return failed;
 }
 
-ExecuteResult executeStatement(Statement *statement, Table *table)
+int main(int argc, char *argv[])
 {
-	switch (statement->type)
+	setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+	DbOptions options;
+	options.poolFrames = DEFAULT_POOL_FRAMES;
+	options.pagerMode = PAGER_BUFFERED;
+	options.groupCommitMax = DEFAULT_GROUP_COMMIT_MAX;
+	options.groupCommitWindowUs = DEFAULT_GROUP_COMMIT_WINDOW_US;
+	options.checkpointIntervalMs = DEFAULT_CHECKPOINT_INTERVAL_MS;
+
+	bool quiet = false; // No prompts, for scripts and pipelines
+	char *script_filename = NULL;
+	string commands;
+	bool script = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "c:f:g:k:mp:qw:")) != -1)
 	{
-	case (STATEMENT_INSERT):
-		return executeInsert(statement, table);
-	case (STATEMENT_SELECT):
-		return executeSelect(statement, table);
+		switch (option)
+		{
+		case ('c'):
+			commands += string(optarg) + "\n";
+			script = true;
+			break;
+		case ('f'):
+			script_filename = optarg;
+			script = true;
+			break;
+		case ('q'):
+			quiet = true;
+			break;
+		case ('g'):
+			options.groupCommitMax = strtoul(optarg, NULL, 10);
+			if (options.groupCommitMax < 1)
+			{
+				printf("Commit groups need at least 1 commit.\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case ('w'):
+			options.groupCommitWindowUs = strtoul(optarg, NULL, 10);
+			break;
+		case ('k'):
+			options.checkpointIntervalMs = strtoul(optarg, NULL, 10);
+			break;
+		case ('m'):
+			options.pagerMode = PAGER_MMAP;
+			break;
+		case ('p'):
+			options.poolFrames = strtoul(optarg, NULL, 10);
+			if (options.poolFrames < MIN_POOL_FRAMES)
+			{
+				printf("Buffer pool needs at least %d frames.\n", MIN_POOL_FRAMES);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			printf("Usage: %s [-m] [-q] [-f script | -c statement] [-p pool_frames] [-g group_commit_max] [-w group_commit_window_us] [-k checkpoint_interval_ms] filename\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
 	}
-}
 
-int metaCommand(string command, Table *table)
-{
-	if (command.compare(".exit") == 0)
+	if (optind >= argc)
 	{
-		db_close(table);
-		exit(0);
+		printf("Must supply a database filename.\n");
+		exit(EXIT_FAILURE);
 	}
-	else if (command.compare(".constants") == 0)
+
+	if (script_filename != NULL && !commands.empty())
 	{
-		printf("Constants:\n");
-		print_constants();
-		return META_COMMAND_SUCCESS;
+		printf("Use either -f or -c, not both.\n");
+		exit(EXIT_FAILURE);
 	}
-	else if (command.compare(".btree") == 0)
+
+	int script_descriptor = -1;
+	if (script_filename != NULL)
 	{
-		printf("Tree:\n");
-		print_leaf_node(get_page(table->pager, 0));
-		return META_COMMAND_SUCCESS;
+		script_descriptor = open(script_filename, O_RDONLY);
+		if (script_descriptor == -1)
+		{
+			printf("Unable to open script '%s'.\n", script_filename);
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	return META_COMMAND_UNRECOGNIZED_COMMAND;
-}
+	char *filename = argv[optind];
+	Database *db = db_open(filename, &options);
 
-int main(int argc, char *argv[])
-{
-	if (argc < 2)
+	if (script)
 	{
-		printf("Must supply a database filename.\n");
-		exit(EXIT_FAILURE);
+		InputBuffer *scriptBuffer = newInputBuffer(script_descriptor);
+		if (script_filename == NULL)
+		{
+			scriptBuffer->buffer = commands;
+			scriptBuffer->eof = true;
+		}
+
+		uint64_t failed = runScript(db, scriptBuffer);
+		if (script_descriptor != -1)
+		{
+			close(script_descriptor);
+		}
+		db_close(db, failed == 0);
+		exit(failed > 0 ? EXIT_FAILURE : 0);
 	}
 
-	char *filename = argv[1];
-	Table *table = db_open(filename);
+	InputBuffer *inputBuffer = newInputBuffer(STDIN_FILENO);
+
+	CommitGroup group;
+	group.size = 0;
 
 	while (true)
 	{
+		if (!quiet)
+		{
+			reply(&group, "db > ");
+		}
+
+		// Close the commit group unless another statement can still join it
+		if (group.size >= options.groupCommitMax)
+		{
+			commitGroupRelease(&group, db);
+		}
+		else if (group.size > 0)
+		{
+			int64_t remaining_us = group.startedUs + options.groupCommitWindowUs - nowUs();
+			if (!inputPending(inputBuffer, remaining_us > 0 ? remaining_us : 0))
+			{
+				commitGroupRelease(&group, db);
+			}
+		}
+
+		// Only flush output when we are about to wait for more input
+		if (!inputPending(inputBuffer, 0))
+		{
+			cout << flush;
+		}
+
 		// Read input
-		cout << "db > ";
 		string input = "";
-		getline(cin, input);
+		if (!readInput(inputBuffer, &input))
+		{
+			// End of input
+			commitGroupRelease(&group, db);
+			db_close(db, true);
+			exit(0);
+		}
 
 		// Handle meta commands
 		if (input[0] == '.')
 		{
-			switch (metaCommand(input, table))
+			commitGroupRelease(&group, db);
+			switch (metaCommand(input, db))
 			{
 			case (META_COMMAND_SUCCESS):
 				continue;
 			case (META_COMMAND_UNRECOGNIZED_COMMAND):
-				cout << "Unrecognized command '" << input << "'" << endl;
+				cout << "Unrecognized command '" << input << "'\n";
 				continue;
 			}
 		}
 
 		// Create a statement
-		Statement statement;
-		switch (prepareStatement(input, &statement))
+		PreparedStatement *prepared;
+		int prepareResult = prepareCached(db, input, &prepared);
+		if (prepareResult != PREPARE_SUCCESS || prepared->statement.type == STATEMENT_SELECT)
 		{
-		case (PREPARE_SUCCESS):
-			break;
-		case (PREPARE_SYNTAX_ERROR):
-			cout << "Syntax error. Could not parse statement" << endl;
-			continue;
-		case (PREPARE_UNRECOGNIZED_STATEMENT):
-			cout << "Unrecognized keyword at start of '" << input << "'" << endl;
-			continue;
-		case (PREPARE_STRING_TOO_LONG):
-			cout << "String is too long." << endl;
-			continue;
-		case (PREPARE_NEGATIVE_ID):
-			cout << "ID must be positive." << endl;
+			// Only writes join commit groups, everything else is answered in order
+			commitGroupRelease(&group, db);
+		}
+
+		if (prepareResult != PREPARE_SUCCESS)
+		{
+			cout << prepareErrorMessage(prepareResult, input) << "\n";
 			continue;
 		}
 
-		switch (executeStatement(&statement, table))
+		ExecuteResult result = executePrepared(prepared, db);
+
+		// Every statement is its own transaction, durable before it is acknowledged
+		uint64_t commit_lsn = pager_log_commit(db->pager);
+		if (prepared->statement.type != STATEMENT_SELECT)
 		{
-		case (EXECUTE_SUCCESS):
-			cout << "Executed." << endl;
-			break;
-		case (EXECUTE_TABLE_FULL):
-			cout << "Error: Table full" << endl;
-			break;
+			if (group.size == 0)
+			{
+				group.startedUs = nowUs();
+			}
+			group.size += 1;
+			group.lsn = commit_lsn;
 		}
+
+		reply(&group, string(executeResultMessage(result)) + "\n");
 	}
 
 	return 0;
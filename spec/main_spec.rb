@@ -1,11 +1,11 @@
 describe 'database' do
   before do
-    `rm -rf test.db`
+    `rm -rf test.db test.db-wal test.csv test.tsv test.sql`
   end
 
-  def run_script(commands)
+  def run_script(commands, options = "")
     raw_output = nil
-    IO.popen("./a.out test.db", "r+") do |pipe|
+    IO.popen("./a.out #{options} test.db", "r+") do |pipe|
       commands.each do |command|
         pipe.puts command
       end
@@ -18,6 +18,20 @@ describe 'database' do
     raw_output.split("\n")
   end
 
+  # Runs statements without .exit and kills the process once they have all executed
+  def run_script_and_crash(commands, options = "", linger = 0)
+    IO.popen("./a.out #{options} test.db", "r+") do |pipe|
+      commands.each do |command|
+        pipe.puts command
+      end
+      pipe.flush
+
+      commands.length.times { pipe.gets("Executed.") }
+      sleep(linger)
+      Process.kill("KILL", pipe.pid)
+    end
+  end
+
   it 'inserts and retreives a row' do
     result = run_script([
       "insert 1 user1 person1@example.com",
@@ -32,13 +46,77 @@ describe 'database' do
     ])
   end
 
-  it 'prints error message when table is full' do
-    script = (1..1401).map do |i|
+  it 'leaves out the prompt in quiet mode' do
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "select",
+      ".exit",
+    ], "-q")
+    expect(result).to eq([
+      "Executed.",
+      "(1, user1, person1@example.com)",
+      "Executed.",
+    ])
+  end
+
+  it 'runs a script file as one transaction' do
+    File.write("test.sql", [
+      "-- two users",
+      "insert 1 user1 person1@example.com",
+      "insert 2 user2 person2@example.com",
+      "",
+      "select where id = 2",
+      ".stats",
+    ].join("\n") + "\n")
+    result = `./a.out -f test.sql test.db`.split("\n")
+    expect($?.exitstatus).to eq(0)
+    expect(result[0]).to eq("(2, user2, person2@example.com)")
+    # Nothing is committed before the end of the script
+    expect(result).to include("wal commits: 0")
+    expect(result.last).to eq("Executed 4 statements, 0 failed.")
+
+    # A failed statement ends the script and rolls back all of it, the import too
+    File.write("test.csv", "3,user3,person3@example.com\n4,user4,person4@example.com\n")
+    File.write("test.sql", [
+      ".import test.csv",
+      "insert 1 again again@example.com",
+      "insert 5 user5 person5@example.com",
+    ].join("\n") + "\n")
+    result = `./a.out -f test.sql test.db`.split("\n")
+    expect($?.exitstatus).to eq(1)
+    expect(result).to eq([
+      "Imported 2 rows.",
+      "line 2: Error: Duplicate key.",
+      "Executed 2 statements, 1 failed. Rolled back.",
+    ])
+    expect(`./a.out -c select test.db`.split("\n")).to eq([
+      "(1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "Executed 1 statements, 0 failed.",
+    ])
+  end
+
+  it 'stores more pages than fit in the buffer pool' do
+    script = (1..5000).map do |i|
       "insert #{i} user#{i} person#{i}@example.com"
     end
     script << ".exit"
-    result = run_script(script)
-    expect(result[-2]).to eq('db > Error: Table full')
+    result = run_script(script, "-p 32")
+    expect(result.count("db > Executed.")).to eq(5000)
+
+    result = run_script([
+      "select where id between 2500 and 2501",
+      "select where id = 5000",
+      ".exit",
+    ], "-p 32")
+    expect(result).to eq([
+      "db > (2500, user2500, person2500@example.com)",
+      "(2501, user2501, person2501@example.com)",
+      "Executed.",
+      "db > (5000, user5000, person5000@example.com)",
+      "Executed.",
+      "db > ",
+    ])
   end
 
   it 'allows inserting strings that are the maximum length' do
@@ -60,20 +138,84 @@ describe 'database' do
 
   it 'prints error message if strings are too long' do
     long_username = "a"*33
-    long_email = "a"*256
+    long_email = "a"*(1024*1024 + 1)
     script = [
-      "insert 1 #{long_username} #{long_email}",
+      "insert 1 #{long_username} person1@example.com",
+      "insert 2 user2 #{long_email}",
       "select",
       ".exit"
     ]
     result = run_script(script)
     expect(result).to match_array([
+      "db > String is too long.",
       "db > String is too long.",
       "db > Executed.",
       "db > ",
     ])
   end
 
+  it 'stores values larger than a page on overflow pages' do
+    large_email = (1..10000).map { |i| (97 + i % 26).chr }.join
+    result = run_script([
+      "insert 1 user1 #{large_email}",
+      "insert 2 user2 person2@example.com",
+      ".exit",
+    ])
+    expect(result.count("db > Executed.")).to eq(2)
+
+    # Only the header, the schema and the leaf are read, the overflow pages are left alone
+    result = run_script([
+      "select where id = 2",
+      ".stats",
+      "select where id = 1",
+      ".exit",
+    ])
+    expect(result[0]).to eq("db > (2, user2, person2@example.com)")
+    expect(result).to include("pages: 6", "pages read: 3")
+    expect(result).to include("db > (1, user1, #{large_email})")
+  end
+
+  it 'reads the overflow pages of a scanned row only for the columns it needs' do
+    # 40 KB emails, ten overflow pages each
+    script = (1..5).map { |i| "insert #{i} user#{i} #{"e#{i}" * 20000}" }
+    result = run_script(script + [".exit"])
+    expect(result.count("db > Executed.")).to eq(5)
+
+    # A fresh session for every query, so pages read counts only its own
+    pages_read = [
+      ["select id from users", "db > (1)"],
+      ["select id, username from users where username = 'user3'", "db > (3, user3)"],
+      ["select email from users where username = 'user3'", "db > (#{"e3" * 20000})"],
+    ].map do |query, first_row|
+      result = run_script([query, ".stats", ".exit"])
+      expect(result[0]).to eq(first_row)
+      result.find { |line| line.start_with?("pages read:") }
+    end
+    # The header, the schema and the leaf, and the email pages of the one row that passes
+    expect(pages_read).to eq(["pages read: 3", "pages read: 3", "pages read: 13"])
+  end
+
+  it 'inserts several rows with one statement' do
+    result = run_script([
+      "insert values (3, user3, person3@example.com), (1, user1, person1@example.com),(2, user2, person2@example.com)",
+      "insert values (4, user4, person4@example.com), (2, again, again@example.com)",
+      "insert values (5, user5, person5@example.com) (6, user6, person6@example.com)",
+      "select",
+      ".stats",
+      ".exit",
+    ])
+    expect(result[0...7]).to eq([
+      "db > Executed.",
+      "db > Error: Duplicate key.",
+      "db > Syntax error. Could not parse statement",
+      "db > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(3, user3, person3@example.com)",
+      "Executed.",
+    ])
+    expect(result).to include("wal commits: 1")
+  end
+
   it 'prints an error message if id is negative' do
     script = [
       "insert -1 test test@test.com",
@@ -88,6 +230,23 @@ describe 'database' do
     ])
   end
 
+  it 'prints an error message if there is a duplicate id' do
+    script = [
+      "insert 1 user1 person1@example.com",
+      "insert 1 user1 person1@example.com",
+      "select",
+      ".exit",
+    ]
+    result = run_script(script)
+    expect(result).to match_array([
+      "db > Executed.",
+      "db > Error: Duplicate key.",
+      "db > (1, user1, person1@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
   it 'keeps data after closing connection' do
     result1 = run_script([
       'insert 1 user1 person1@example.com',
@@ -109,6 +268,610 @@ describe 'database' do
     ])
   end
 
+  it 'refuses to open a file that is not a database' do
+    File.write("test.db", "x" * 4096)
+    result = run_script([".exit"])
+    expect(result).to eq([
+      "File is not a database or was written by an incompatible version.",
+    ])
+    expect(File.exist?("test.db-wal")).to eq(false)
+  end
+
+  it 'looks up a single row by id' do
+    # Maximum length emails, so the rows take up four leaves
+    script = (1..30).map do |i|
+      "insert #{i} user#{i} #{"person#{i}@example.com".ljust(255, "x")}"
+    end
+    script << ".btree"
+    script << "select where id = 17"
+    script << "select where id = 31"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.select { |line| line =~ /^ *(internal|leaf)/ }).to eq([
+      "internal (size 3)",
+      "  leaf (size 7)",
+      "  leaf (size 7)",
+      "  leaf (size 7)",
+      "  leaf (size 9)",
+    ])
+    expect(result.last(4)).to eq([
+      "db > (17, user17, #{"person17@example.com".ljust(255, "x")})",
+      "Executed.",
+      "db > Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'scans a range of ids across leaves' do
+    # Maximum length emails, so the range starts in the first leaf and ends in the second
+    script = (1..30).map do |i|
+      "insert #{i * 2} user#{i} #{"person#{i}@example.com".ljust(255, "x")}"
+    end
+    script << ".btree"
+    script << "select where id between 11 and 20"
+    script << "select where id between 61 and 70"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.select { |line| line =~ /^ *(internal|leaf|- key)/ }).to eq([
+      "internal (size 3)",
+      "  leaf (size 7)",
+      "  - key 14",
+      "  leaf (size 7)",
+      "  - key 28",
+      "  leaf (size 7)",
+      "  - key 42",
+      "  leaf (size 9)",
+    ])
+    expect(result.last(8)).to eq([
+      "db > (12, user6, #{"person6@example.com".ljust(255, "x")})",
+      "(14, user7, #{"person7@example.com".ljust(255, "x")})",
+      "(16, user8, #{"person8@example.com".ljust(255, "x")})",
+      "(18, user9, #{"person9@example.com".ljust(255, "x")})",
+      "(20, user10, #{"person10@example.com".ljust(255, "x")})",
+      "Executed.",
+      "db > Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'deletes rows by id and by range' do
+    script = (1..10).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "delete where id = 3"
+    script << "delete where id between 5 and 8"
+    script << "delete where id = 42"
+    script << "select"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result[13...(result.length)]).to eq([
+      "db > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(4, user4, person4@example.com)",
+      "(9, user9, person9@example.com)",
+      "(10, user10, person10@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'merges nodes and reuses their pages after deletes' do
+    insert_rows = (1..30).map do |i|
+      "insert #{i} user#{i} #{"person#{i}@example.com".ljust(255, "x")}"
+    end
+    script = insert_rows + [
+      "delete where id between 1 and 29",
+      ".btree",
+      ".stats",
+      "delete where id = 30",
+    ] + insert_rows + [
+      ".stats",
+      ".exit",
+    ]
+    result = run_script(script)
+
+    expect(result).to include("db > Tree:", "leaf (size 1)", "  - 0 : 30")
+    expect(result.select { |line| line.start_with?("pages:", "free pages:") }).to eq([
+      "pages: 7",
+      "free pages: 4",
+      "pages: 7",
+      "free pages: 0",
+    ])
+  end
+
+  it 'updates a row in place' do
+    script = (1..3).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    result = run_script([
+      "update set email=someone@example.com where id = 2",
+      "update set username=u3, email=e3 where id = 3",
+      ".stats",
+      "select",
+      ".exit",
+    ])
+    expect(result).to include("wal frames written: 2")
+    expect(result[-5...(result.length)]).to eq([
+      "db > (1, user1, person1@example.com)",
+      "(2, user2, someone@example.com)",
+      "(3, u3, e3)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'splits a leaf when updated rows no longer fit' do
+    script = (1..14).map do |i|
+      "insert #{i} user#{i} #{"person#{i}@example.com".ljust(255, "x")}"
+    end
+    script << "update set username=#{"a" * 32}"
+    script << ".btree"
+    script << "select where id = 14"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result).to include("internal (size 1)")
+    expect(result[-3]).to eq("db > (14, #{"a" * 32}, #{"person14@example.com".ljust(255, "x")})")
+  end
+
+  it 'imports rows from a CSV file in key order' do
+    File.write("test.csv", [
+      "id,username,email",
+      "3,user3,person3@example.com",
+      "1,user1,\"person1@example.com\"",
+      "2,user2,person2@example.com",
+      "1,again,again@example.com",
+    ].join("\n") + "\n")
+    result = run_script([
+      ".import test.csv",
+      "select",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Imported 3 rows.",
+      "Skipped 1 rows with duplicate keys.",
+      "db > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(3, user3, person3@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'imports empty text fields but not empty numbers' do
+    File.write("test.csv", "1,,30\n2,bob,4\n")
+    result = run_script([
+      "create table scores (id integer, player text(8), points integer)",
+      ".import test.csv scores",
+      ".exit",
+    ])
+    expect(result).to eq(["db > Executed.", "db > Imported 2 rows.", "db > "])
+
+    File.write("test.csv", "3,carl,\n")
+    result = run_script([".import test.csv scores", "select from scores", ".exit"])
+    expect(result).to eq([
+      "db > Could not parse line 1.",
+      "db > (1, , 30)",
+      "(2, bob, 4)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'builds the tree bottom-up at the given fill factor' do
+    File.write("test.tsv", (1..1000).to_a.reverse.map { |i| "#{i}\tuser#{i}\tperson#{i}@example.com\n" }.join)
+    roots = [100, 50].map do |fill|
+      `rm -rf test.db test.db-wal`
+      result = run_script([".import test.tsv #{fill}", "select where id = 1000", ".btree", ".exit"])
+      expect(result[0]).to eq("db > Imported 1000 rows.")
+      expect(result[1]).to eq("db > (1000, user1000, person1000@example.com)")
+      result[4]
+    end
+    expect(roots).to eq(["internal (size 9)", "internal (size 19)"])
+  end
+
+  it 'rebalances the last nodes of a bulk loaded tree' do
+    # At 50% a leaf takes 7 of these rows and an internal node 256 leaves,
+    # so the last leaf gets one row and is the only child of its parent
+    File.write("test.tsv", (1..1793).map { |i| "#{i}\tuser#{i}\t#{"person#{i}@example.com".ljust(255, "x")}\n" }.join)
+    result = run_script([
+      ".import test.tsv 50",
+      ".btree",
+      "select where id = 1",
+      "select where id = 1785",
+      "select where id = 1793",
+      ".exit",
+    ])
+    expect(result[0]).to eq("db > Imported 1793 rows.")
+    nodes = result.select { |line| line =~ /^ *(internal|leaf)/ }
+    expect(nodes).to eq(["internal (size 255)"] + ["  leaf (size 7)"] * 255 + ["  leaf (size 8)"])
+    expect(result[-7]).to eq("db > (1, user1, #{"person1@example.com".ljust(255, "x")})")
+    expect(result[-5]).to eq("db > (1785, user1785, #{"person1785@example.com".ljust(255, "x")})")
+    expect(result[-3]).to eq("db > (1793, user1793, #{"person1793@example.com".ljust(255, "x")})")
+  end
+
+  it 'parses quoted strings, column lists and predicates' do
+    result = run_script([
+      "insert into users (email, id, username) values ('o''brien@example.com', 1, 'o brien'), ('b@example.com', 2, bob)",
+      "INSERT INTO users VALUES (3, 'carol', 'c@example.com');",
+      "select id, email from users where username = 'bob'",
+      "update users set username = 'Robert' where email = b@example.com",
+      "select * from users where id >= 2 and email != 'c@example.com'",
+      "delete from users where username between 'a' and 'p'",
+      "select username from users",
+      "select nope from users",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > (2, b@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > (2, Robert, b@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > (Robert)",
+      "Executed.",
+      "db > Syntax error. Could not parse statement",
+      "db > ",
+    ])
+  end
+
+  it 'creates tables with typed columns that are kept in the schema' do
+    result = run_script([
+      "create table scores (id integer, player text(8), points integer, ratio real, badge blob)",
+      "insert into scores values (1, ann, 30, 0.5, x'00ff'), (2, bob, -4, 2, x'')",
+      "insert into scores values (3, carl, 5, 1e400, x'01')",
+      "insert into scores values (3, carlotta_long, 5, 1, x'01')",
+      "create table scores (id integer)",
+      "create table notes (body text, id integer)",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > Syntax error. Could not parse statement",
+      "db > String is too long.",
+      "db > Error: Table already exists.",
+      "db > Syntax error. Could not parse statement",
+      "db > ",
+    ])
+
+    result = run_script([
+      "select * from scores where points > 1",
+      "select player from scores where ratio between 1 and 3",
+      "select from notes",
+      "select id, name, root from schema",
+      "insert into schema values (3, notes, 4, x)",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > (1, ann, 30, 0.5, x'00ff')",
+      "Executed.",
+      "db > (bob)",
+      "Executed.",
+      "db > Unknown table.",
+      "db > (1, users, 2)",
+      "(2, scores, 3)",
+      "Executed.",
+      "db > Table is read-only.",
+      "db > ",
+    ])
+  end
+
+  it 'keeps secondary indexes in sync and looks rows up in them' do
+    result = run_script([
+      "insert into users values (1, ann, ann@example.com), (2, bob, bob@example.com), (3, carl, ann@example.com)",
+      "create index on users (email)",
+      "create index users_email on users (username)",
+      "create index on users (id)",
+      "update users set email = 'carl@example.com' where username = 'carl'",
+      "delete from users where email = 'bob@example.com'",
+      "create index on users (username)",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > Error: Index already exists.",
+      "db > Syntax error. Could not parse statement",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > ",
+    ])
+
+    result = run_script([
+      "select * from users where email = 'ann@example.com'",
+      "select id from users where username like 'c%'",
+      ".btree users_email",
+      "select name from schema where id > 1",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > (1, ann, ann@example.com)",
+      "Executed.",
+      "db > (3)",
+      "Executed.",
+      "db > Tree:",
+      "leaf (size 2)",
+      "  - 0 : 616e6e406578616d706c652e:1",
+      "  - 1 : 6361726c406578616d706c65:3",
+      "db > (users_email)",
+      "(users_username)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'reads only a few pages of a large table through an index' do
+    File.write("test.tsv", (1..20000).map { |i| "#{i}\tuser#{i}\tperson#{i}@example.com\n" }.join)
+    result = run_script([".import test.tsv", "create index on users (email)", ".exit"])
+    expect(result[1]).to eq("db > Executed.")
+
+    # A fresh session for every query, so pages read counts only its own
+    pages_read = {
+      "select where email = 'person12345@example.com'" => "db > (12345, user12345, person12345@example.com)",
+      # In index order, by a scan 1234 would come first
+      "select where email like 'person1234%'" => "db > (12340, user12340, person12340@example.com)",
+      "select where username = 'user12345'" => "db > (12345, user12345, person12345@example.com)",
+    }.map do |query, first_row|
+      result = run_script([query, ".stats", ".exit"])
+      expect(result[0]).to eq(first_row)
+      result.find { |line| line.start_with?("pages read:") }
+    end
+    # The index finds the rows in a handful of pages, a scan of the unindexed username reads them all
+    expect(pages_read).to eq(["pages read: 7", "pages read: 9", "pages read: 238"])
+  end
+
+  it 'answers from the columns a covering index includes' do
+    result = run_script([
+      "insert into users values (1, ann, ann@example.com), (2, bob, bob@example.com)",
+      "create index on users (username) include (email)",
+      "create index on users (email) include (email)",
+      "update users set email = 'bobby@example.com' where id = 2",
+      "select email from users where username = 'bob'",
+      "select id, email from users where username like 'a%'",
+      "select sql from schema where name = 'users_username'",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > Syntax error. Could not parse statement",
+      "db > Executed.",
+      "db > (bobby@example.com)",
+      "Executed.",
+      "db > (1, ann@example.com)",
+      "Executed.",
+      "db > (create index users_username on users (username) include (email))",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'skips the table when the index includes every column a select reads' do
+    File.write("test.tsv", (1..20000).map { |i| "#{i}\tuser#{i}\tperson#{i}@example.com\n" }.join)
+    pages_read = ["", " include (email)"].map do |include|
+      `rm -rf test.db test.db-wal`
+      result = run_script([".import test.tsv", "create index on users (username)#{include}", ".exit"])
+      expect(result[1]).to eq("db > Executed.")
+
+      result = run_script([".bind user12345", "select email from users where username = ?", ".stats", ".exit"])
+      expect(result[0]).to eq("db > db > (person12345@example.com)")
+      result.find { |line| line.start_with?("pages read:") }
+    end
+    # The covering index saves the descent through the table to its leaf
+    expect(pages_read).to eq(["pages read: 7", "pages read: 5"])
+  end
+
+  it 'reuses the plan of a repeated statement with bound parameters' do
+    result = run_script([
+      ".bind 1 alice 'alice@example.com'",
+      "insert into users values (?, ?, ?)",
+      ".bind 2 bob bob@example.com",
+      "insert into users values (?, ?, ?);",
+      ".bind 3",
+      "insert into users values (?, ?, ?)",
+      "select where id >= ?",
+      ".bind 2",
+      "select where id >= ?",
+      ".stats",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > db > Executed.",
+      "db > db > Executed.",
+      "db > db > Error: Parameter not bound.",
+      "db > Executed.",
+      "db > db > (2, bob, bob@example.com)",
+      "Executed.",
+      "db > Stats:",
+    ] + result[7...-3] + [
+      "plan cache hits: 3",
+      "plan cache misses: 2",
+      "db > ",
+    ])
+  end
+
+  it 'keeps values bound to a cached multi-row insert with their rows' do
+    result = run_script([
+      ".bind 5 1",
+      "insert into users values (?, a, a@x.com), (?, b, b@x.com)",
+      ".bind 2 9",
+      "insert into users values (?, a, a@x.com), (?, b, b@x.com)",
+      "select",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > db > Executed.",
+      "db > db > Executed.",
+      "db > (1, b, b@x.com)",
+      "(2, a, a@x.com)",
+      "(5, a, a@x.com)",
+      "(9, b, b@x.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'prints an error message for a malformed where clause' do
+    script = [
+      "select where id = 3 or id = 4",
+      "select where name = 3",
+      "select where id between 1 or 2",
+      ".exit",
+    ]
+    result = run_script(script)
+    expect(result).to eq([
+      "db > Syntax error. Could not parse statement",
+      "db > Syntax error. Could not parse statement",
+      "db > Syntax error. Could not parse statement",
+      "db > ",
+    ])
+  end
+
+  it 'does not write to the database file in a read-only session' do
+    script = (1..30).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+    modified_at = File.mtime("test.db")
+
+    run_script([
+      "select",
+      ".btree",
+      ".exit",
+    ])
+    expect(File.mtime("test.db")).to eq(modified_at)
+  end
+
+  it 'reads and writes the same data in mmap mode' do
+    script = (1..158).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    result = run_script([
+      "insert 159 user159 person159@example.com",
+      "select where id between 157 and 159",
+      ".stats",
+      ".exit",
+    ], "-m -k 0")
+    expect(result).to eq([
+      "db > Executed.",
+      "db > (157, user157, person157@example.com)",
+      "(158, user158, person158@example.com)",
+      "(159, user159, person159@example.com)",
+      "Executed.",
+      "db > Stats:",
+      "mode: mmap",
+      "pages: 6",
+      "free pages: 0",
+      "mapped pages: 5",
+      "pool frames: 1/1024",
+      "pages read: 0",
+      "pages written: 0",
+      "wal frames written: 3",
+      "wal commits: 1",
+      "wal syncs: 1",
+      "checkpoints: 0",
+      "plan cache hits: 0",
+      "plan cache misses: 2",
+      "db > ",
+    ])
+
+    result = run_script([
+      "select where id = 159",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > (159, user159, person159@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'recovers committed rows from the write-ahead log after a crash' do
+    script = (1..20).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    run_script_and_crash(script, "-k 0")
+    expect(File.size("test.db-wal")).to be > 0
+
+    result = run_script([
+      "select where id between 13 and 20",
+      ".exit",
+    ])
+    expect(result).to eq((13..20).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" }.tap { |rows|
+      rows[0] = "db > " + rows[0]
+    } + [
+      "Executed.",
+      "db > ",
+    ])
+    expect(File.exist?("test.db-wal")).to eq(false)
+  end
+
+  it 'recovers rows spilled to the log by a small buffer pool' do
+    script = (1..5000).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    run_script_and_crash(script, "-p 32")
+
+    result = run_script([
+      "select where id = 1",
+      "select where id = 5000",
+      ".exit",
+    ], "-p 32")
+    expect(result).to eq([
+      "db > (1, user1, person1@example.com)",
+      "Executed.",
+      "db > (5000, user5000, person5000@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'checkpoints the log in the background' do
+    script = (1..20).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    run_script_and_crash(script, "-k 10", 0.5)
+    expect(File.size("test.db-wal")).to eq(24)
+    expect(File.size("test.db")).to eq(4096 * 3)
+
+    result = run_script([
+      "select where id = 20",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > (20, user20, person20@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'shares one log sync between the commits of a group' do
+    script = (1..100).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".stats"
+    script << ".exit"
+    result = run_script(script, "-g 50 -w 1000000")
+
+    expect(result.count("db > Executed.")).to eq(100)
+    expect(result).to include("wal commits: 100", "wal syncs: 2")
+  end
+
   it 'prints constants' do
     script = [
       ".constants",
@@ -118,12 +881,14 @@ describe 'database' do
     
     expect(result).to match_array([
       "db > Constants:",
-      "ROW_SIZE: 293",
+      "ROW_MAX_SIZE: 1351",
       "COMMON_NODE_HEADER_SIZE: 6",
-      "LEAF_NODE_HEADER_SIZE: 10",
-      "LEAF_NODE_CELL_SIZE: 297",
-      "LEAF_NODE_SPACE_FOR_CELLS: 4086",
-      "LEAF_NODE_MAX_CELLS: 13",
+      "LEAF_NODE_HEADER_SIZE: 18",
+      "LEAF_NODE_SLOT_SIZE: 8",
+      "LEAF_NODE_SPACE_FOR_CELLS: 4078",
+      "INTERNAL_NODE_HEADER_SIZE: 14",
+      "INTERNAL_NODE_CELL_SIZE: 8",
+      "INTERNAL_NODE_MAX_KEYS: 510",
       "db > ",
     ])
   end
@@ -142,10 +907,91 @@ describe 'database' do
       "db > Executed.",
       "db > Tree:",
       "leaf (size 3)",
-      "  - 0 : 3",
-      "  - 1 : 1",
-      "  - 2 : 2",
+      "  - 0 : 1",
+      "  - 1 : 2",
+      "  - 2 : 3",
       "db > "
     ])
   end
+
+  it 'packs short rows densely into a leaf' do
+    script = (1..100).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result[100]).to eq("db > Tree:")
+    expect(result[101]).to eq("leaf (size 100)")
+  end
+
+  it 'allows printing out the structure of a 3-leaf-node btree' do
+    # Maximum length emails, so only 14 rows fit in a leaf
+    script = (1..22).map do |i|
+      "insert #{i} user#{i} #{"person#{i}@example.com".ljust(255, "x")}"
+    end
+    script << ".btree"
+    script << "insert 23 user23 person23@example.com"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result[22...(result.length)]).to eq([
+      "db > Tree:",
+      "internal (size 2)",
+      "  leaf (size 7)",
+      "    - 0 : 1",
+      "    - 1 : 2",
+      "    - 2 : 3",
+      "    - 3 : 4",
+      "    - 4 : 5",
+      "    - 5 : 6",
+      "    - 6 : 7",
+      "  - key 7",
+      "  leaf (size 7)",
+      "    - 0 : 8",
+      "    - 1 : 9",
+      "    - 2 : 10",
+      "    - 3 : 11",
+      "    - 4 : 12",
+      "    - 5 : 13",
+      "    - 6 : 14",
+      "  - key 14",
+      "  leaf (size 8)",
+      "    - 0 : 15",
+      "    - 1 : 16",
+      "    - 2 : 17",
+      "    - 3 : 18",
+      "    - 4 : 19",
+      "    - 5 : 20",
+      "    - 6 : 21",
+      "    - 7 : 22",
+      "db > Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'prints all rows in a multi-level tree' do
+    # Maximum length emails inserted in reverse, so the leaves split from the left
+    script = (1..30).to_a.reverse.map do |i|
+      "insert #{i} user#{i} #{"person#{i}@example.com".ljust(255, "x")}"
+    end
+    script << ".btree"
+    script << "select"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.select { |line| line =~ /^ *(internal|leaf)/ }).to eq([
+      "internal (size 2)",
+      "  leaf (size 14)",
+      "  leaf (size 8)",
+      "  leaf (size 8)",
+    ])
+    rows = (1..30).map { |i| "(#{i}, user#{i}, #{"person#{i}@example.com".ljust(255, "x")})" }
+    rows[0] = "db > " + rows[0]
+    expect(result.last(32)).to eq(rows + [
+      "Executed.",
+      "db > ",
+    ])
+  end
 end